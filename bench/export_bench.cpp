@@ -0,0 +1,400 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+// Benchmarks the whole export path: loading the project, decoding,
+// padding, packing, compositing, encoding and writing the outputs. A
+// corpus of sprites is generated first, each thread count is then
+// exported with a cold image cache and again with the cache from the
+// cold run.
+//
+//   spritepacker_export_bench [-dir export_bench] [-sprites 200]
+//                             [-atlases 4] [-threads 1,2,4] [-runs 3]
+//                             [-csv results.csv]
+//                             [-baseline results.csv] [-tolerance 0.1]
+//                             [-slack 5]
+//
+// Phase times come from the profile scopes and are summed over threads.
+// A phase regresses if it is slower than the baseline by more than the
+// tolerance plus the slack in milliseconds, which hides the noise of
+// short phases such as writing small files.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <system_error>
+
+#include "SDL.h"
+#include "lodepng/lodepng.h"
+#include "cache.h"
+#include "manifest.h"
+#include "profile.h"
+#include "project.h"
+
+struct Corpus {
+    std::string project_file;
+    size_t sprites = 0;
+    // Decoded size of all sprites
+    size_t bytes = 0;
+};
+
+struct Result {
+    std::string mode;
+    int threads = 0;
+    std::string phase;
+    size_t calls = 0;
+    double time_ms = 0.0;
+};
+
+// Random numbers are derived from the raw mt19937 output, which is the
+// same on every platform, unlike the standard distributions.
+class Random {
+public:
+    explicit Random(uint32_t seed) : engine(seed) {}
+
+    int Range(int lo, int hi) {
+        return lo + int(engine() % uint32_t(hi - lo + 1));
+    }
+
+private:
+    std::mt19937 engine;
+};
+
+// Flat colors in 4x4 blocks with a transparent background, compresses
+// well like most pixel art.
+static void DrawPixelArt(Random *rng, int w, int h,
+                         std::vector<unsigned char> *pixels) {
+    unsigned char palette[8][4];
+    for (auto &color : palette) {
+        for (int c = 0; c < 3; ++c) color[c] = rng->Range(0, 255);
+        color[3] = 255;
+    }
+    palette[0][3] = 0;
+
+    for (int by = 0; by < h; by += 4) {
+        for (int bx = 0; bx < w; bx += 4) {
+            const auto *color = palette[rng->Range(0, 7)];
+            for (int y = by; y < std::min(by + 4, h); ++y) {
+                for (int x = bx; x < std::min(bx + 4, w); ++x) {
+                    memcpy(&(*pixels)[(size_t(y) * w + x) * 4], color, 4);
+                }
+            }
+        }
+    }
+}
+
+// Gradients with noise and a soft alpha edge, compresses poorly like
+// photographs and painted sprites.
+static void DrawPhoto(Random *rng, int w, int h,
+                      std::vector<unsigned char> *pixels) {
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            auto *p = &(*pixels)[(size_t(y) * w + x) * 4];
+            float dx = (x + 0.5f) / w - 0.5f;
+            float dy = (y + 0.5f) / h - 0.5f;
+            float d = sqrtf(dx * dx + dy * dy) * 2.0f;
+            p[0] = (unsigned char)(x * 255 / w);
+            p[1] = (unsigned char)(y * 255 / h);
+            p[2] = (unsigned char)rng->Range(0, 255);
+            p[3] = (unsigned char)(255 * std::max(0.0f, 1.0f - d * d));
+        }
+    }
+}
+
+static bool WriteSprite(const std::string &filename, int w, int h,
+                        bool alpha, const std::vector<unsigned char> &rgba) {
+    if (alpha) {
+        return lodepng_encode32_file(filename.c_str(), rgba.data(), w, h) == 0;
+    }
+    std::vector<unsigned char> rgb(size_t(w) * h * 3);
+    for (size_t i = 0; i < size_t(w) * h; ++i) {
+        memcpy(&rgb[i * 3], &rgba[i * 4], 3);
+    }
+    return lodepng_encode24_file(filename.c_str(), rgb.data(), w, h) == 0;
+}
+
+// Sprites alternate between pixel art and photographic, with and without
+// alpha. Most sprites are small with a few large ones.
+static bool MakeCorpus(const std::string &dir, int sprites, int atlases,
+                       Corpus *corpus) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir + "/sprites", ec);
+    if (ec) return false;
+
+    Random rng(1);
+    std::vector<std::string> lines(atlases);
+    for (int i = 0; i < atlases; ++i) {
+        lines[i] = "atlas atlas" + std::to_string(i) + ".atlas\n"
+                   "image atlas" + std::to_string(i) + ".png\n"
+                   "padding 1\n"
+                   "anim <none>\n";
+    }
+
+    for (int i = 0; i < sprites; ++i) {
+        int size_class = rng.Range(0, 9);
+        int lo = size_class < 6 ? 8 : size_class < 9 ? 32 : 96;
+        int hi = size_class < 6 ? 32 : size_class < 9 ? 96 : 256;
+        int w = rng.Range(lo, hi);
+        int h = rng.Range(lo, hi);
+
+        std::vector<unsigned char> pixels(size_t(w) * h * 4);
+        bool photo = (i / 2) % 2 == 1;
+        bool alpha = i % 2 == 0;
+        if (photo) {
+            DrawPhoto(&rng, w, h, &pixels);
+        } else {
+            DrawPixelArt(&rng, w, h, &pixels);
+        }
+        auto name = "sprites/s" + std::to_string(i) + ".png";
+        if (!WriteSprite(dir + "/" + name, w, h, alpha, pixels)) {
+            return false;
+        }
+        lines[i % atlases] += "sprite " + name + "\n";
+        corpus->sprites++;
+        corpus->bytes += pixels.size();
+    }
+
+    corpus->project_file = dir + "/bench.spritepack";
+    auto *file = fopen(corpus->project_file.c_str(), "w+");
+    if (file == nullptr) return false;
+    for (const auto &atlas : lines) {
+        fprintf(file, "%s", atlas.c_str());
+    }
+    fclose(file);
+    return true;
+}
+
+static bool LoadProject(const Corpus &corpus, const std::string &dir,
+                        spack::Project *project) {
+    if (!project->Load(nullptr, corpus.project_file, false)) {
+        return false;
+    }
+    for (auto &atlas : project->atlases) {
+        atlas->working_dir = dir;
+    }
+    return true;
+}
+
+// Exports every atlas, the manifests are removed first so atlases are
+// always packed again.
+static bool RunExport(const Corpus &corpus, const std::string &dir,
+                      int threads, spack::ImageCache *cache,
+                      std::vector<Result> *results) {
+    spack::Project project;
+    if (!LoadProject(corpus, dir, &project)) return false;
+    for (const auto &atlas : project.atlases) {
+        std::error_code ec;
+        std::filesystem::remove(spack::ManifestPath(*atlas), ec);
+    }
+
+    spack::SetImageCache(cache);
+    spack::ResetProfile();
+    auto begin = std::chrono::steady_clock::now();
+
+    spack::Project timed;
+    bool ok = LoadProject(corpus, dir, &timed);
+    spack::ExportQueue queue(threads);
+    timed.QueueExports(&queue, true);
+    ok = queue.Finish().size() == 0 && ok;
+
+    auto end = std::chrono::steady_clock::now();
+    spack::SetImageCache(nullptr);
+
+    Result total;
+    total.phase = "total";
+    total.calls = 1;
+    total.time_ms = std::chrono::duration<double, std::milli>(
+        end - begin).count();
+    results->push_back(total);
+    for (const auto &t : spack::ProfileTotals()) {
+        Result r;
+        r.phase = t.name;
+        r.calls = t.count;
+        r.time_ms = t.duration / 1000.0;
+        results->push_back(r);
+    }
+    return ok;
+}
+
+static const char *CsvHeader =
+    "mode,threads,phase,calls,time_ms,sprites_per_s,mb_per_s\n";
+
+static void WriteResult(FILE *file, const Corpus &corpus, const Result &r) {
+    double seconds = std::max(r.time_ms, 1e-6) / 1000.0;
+    fprintf(file, "%s,%d,%s,%zu,%.3f,%.1f,%.2f\n",
+            r.mode.c_str(), r.threads, r.phase.c_str(), r.calls, r.time_ms,
+            corpus.sprites / seconds, corpus.bytes / 1e6 / seconds);
+}
+
+static std::string ResultKey(const Result &r) {
+    return r.mode + "," + std::to_string(r.threads) + "," + r.phase;
+}
+
+static bool ReadBaseline(const char *filename,
+                         std::map<std::string, double> *baseline) {
+    std::ifstream file(filename);
+    if (!file) return false;
+
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        std::stringstream fields(line);
+        std::vector<std::string> f;
+        std::string field;
+        while (std::getline(fields, field, ',')) f.push_back(field);
+        if (f.size() != 7) continue;
+        (*baseline)[f[0] + "," + f[1] + "," + f[2]] = atof(f[4].c_str());
+    }
+    return true;
+}
+
+static std::vector<int> SplitList(const char *list) {
+    std::vector<int> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item != "") items.push_back(atoi(item.c_str()));
+    }
+    return items;
+}
+
+// Median time of each phase over the runs.
+static std::vector<Result> Median(const std::vector<std::vector<Result>> &runs,
+                                  const std::string &mode, int threads) {
+    std::map<std::string, std::vector<Result>> phases;
+    for (const auto &run : runs) {
+        for (const auto &r : run) phases[r.phase].push_back(r);
+    }
+    std::vector<Result> results;
+    for (auto &it : phases) {
+        auto &rs = it.second;
+        std::sort(rs.begin(), rs.end(), [](const Result &a, const Result &b) {
+            return a.time_ms < b.time_ms;
+        });
+        auto r = rs[rs.size() / 2];
+        r.mode = mode;
+        r.threads = threads;
+        results.push_back(r);
+    }
+    return results;
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = "export_bench";
+    int sprites = 200;
+    int atlases = 4;
+    auto threads = SplitList("1,2,4");
+    int runs = 3;
+    const char *csv_file = nullptr;
+    const char *baseline_file = nullptr;
+    double tolerance = 0.1;
+    double slack_ms = 5.0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "-sprites") == 0 && i + 1 < argc) {
+            sprites = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "-atlases") == 0 && i + 1 < argc) {
+            atlases = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = SplitList(argv[++i]);
+        } else if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+            runs = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc) {
+            csv_file = argv[++i];
+        } else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) {
+            baseline_file = argv[++i];
+        } else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-slack") == 0 && i + 1 < argc) {
+            slack_ms = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "error: Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Corpus corpus;
+    if (!MakeCorpus(dir, sprites, atlases, &corpus)) {
+        fprintf(stderr, "error: Failed to generate corpus in %s\n",
+                dir.c_str());
+        return 1;
+    }
+    spack::StartProfile();
+
+    std::vector<Result> results;
+    for (int t : threads) {
+        std::vector<std::vector<Result>> cold(runs), warm(runs);
+        for (int i = 0; i < runs; ++i) {
+            // Only the decoded images are cold, the OS file cache is not
+            spack::ImageCache cache;
+            if (!RunExport(corpus, dir, t, &cache, &cold[i])
+                    || !RunExport(corpus, dir, t, &cache, &warm[i])) {
+                fprintf(stderr, "error: Failed to export %s\n",
+                        corpus.project_file.c_str());
+                return 1;
+            }
+        }
+        for (const auto &r : Median(cold, "cold", t)) results.push_back(r);
+        for (const auto &r : Median(warm, "warm", t)) results.push_back(r);
+    }
+
+    FILE *csv = nullptr;
+    if (csv_file != nullptr && (csv = fopen(csv_file, "w+")) == nullptr) {
+        fprintf(stderr, "error: Failed to write %s\n", csv_file);
+        return 1;
+    }
+    printf("%s", CsvHeader);
+    if (csv != nullptr) fprintf(csv, "%s", CsvHeader);
+    for (const auto &r : results) {
+        WriteResult(stdout, corpus, r);
+        if (csv != nullptr) WriteResult(csv, corpus, r);
+    }
+    if (csv != nullptr) fclose(csv);
+
+    if (baseline_file == nullptr) {
+        return 0;
+    }
+    std::map<std::string, double> baseline;
+    if (!ReadBaseline(baseline_file, &baseline)) {
+        fprintf(stderr, "error: Failed to read %s\n", baseline_file);
+        return 1;
+    }
+    bool ok = true;
+    for (const auto &r : results) {
+        auto it = baseline.find(ResultKey(r));
+        if (it == baseline.end()) continue;
+        if (r.time_ms > it->second * (1 + tolerance) + slack_ms) {
+            fprintf(stderr, "regression: %s %.3fms, baseline %.3fms\n",
+                    ResultKey(r).c_str(), r.time_ms, it->second);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,438 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+// Benchmarks the packer on synthetic sprite sizes and on the sprites of
+// existing projects, without loading any images or using SDL.
+//
+//   spritepacker_bench [-dist uniform,power,tiles,tall,mixed]
+//                      [-count 100] [-runs 3] [-seed 1]
+//                      [-replay project.spritepack|sizes.txt]...
+//                      [-csv results.csv]
+//                      [-baseline results.csv] [-tolerance 0.1]
+//
+// Results are printed as CSV. Layout results only depend on the inputs, so
+// they can be compared exactly across commits, while times are compared
+// with the tolerance.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include "stb/stb_image.h"
+#include "pack.h"
+
+using spack::PackRect;
+
+struct Corpus {
+    std::string name;
+    std::vector<PackRect> rects;
+};
+
+struct Heuristic {
+    const char *name;
+    bool (*compare)(const PackRect &a, const PackRect &b);
+    bool square;
+};
+
+struct Result {
+    std::string corpus;
+    std::string heuristic;
+    size_t count = 0;
+    int width = 0, height = 0;
+    double occupancy = 0.0;
+    int retries = 0;
+    size_t peak_mask_bytes = 0;
+    double time_ms = 0.0;
+};
+
+static bool ByArea(const PackRect &a, const PackRect &b) {
+    return a.w * a.h > b.w * b.h;
+}
+
+static bool ByHeight(const PackRect &a, const PackRect &b) {
+    return a.h > b.h;
+}
+
+static bool ByWidth(const PackRect &a, const PackRect &b) {
+    return a.w > b.w;
+}
+
+static bool ByMaxSide(const PackRect &a, const PackRect &b) {
+    return std::max(a.w, a.h) > std::max(b.w, b.h);
+}
+
+// "area" is the order used by the editor for sprites in the same
+// animation group.
+static const Heuristic heuristics[] = {
+    {"input", nullptr, false},
+    {"area", &ByArea, false},
+    {"height", &ByHeight, false},
+    {"width", &ByWidth, false},
+    {"maxside", &ByMaxSide, false},
+    {"area-square", &ByArea, true},
+};
+
+// Random numbers are derived from the raw mt19937 output, which is the
+// same on every platform, unlike the standard distributions.
+class Random {
+public:
+    explicit Random(uint32_t seed) : engine(seed) {}
+
+    int Range(int lo, int hi) {
+        return lo + int(engine() % uint32_t(hi - lo + 1));
+    }
+    double Unit() {
+        return (engine() >> 8) * (1.0 / 16777216.0);
+    }
+
+private:
+    std::mt19937 engine;
+};
+
+static PackRect MakeRect(int w, int h) {
+    PackRect rect;
+    rect.w = w;
+    rect.h = h;
+    return rect;
+}
+
+static PackRect Uniform(Random *rng) {
+    return MakeRect(rng->Range(4, 128), rng->Range(4, 128));
+}
+
+static PackRect PowerLaw(Random *rng) {
+    // Many small sprites and a few large ones, alpha = 2.5
+    double size = 4.0 * pow(1.0 - rng->Unit(), -1.0 / 1.5);
+    int w = int(std::min(size, 512.0));
+    int h = int(std::min(size * (0.5 + rng->Unit() * 1.5), 512.0));
+    return MakeRect(std::max(w, 1), std::max(h, 1));
+}
+
+static PackRect Tile(Random *rng) {
+    int size = rng->Range(0, 3) == 0 ? 32 : 16;
+    return MakeRect(size, size);
+}
+
+static PackRect TallThin(Random *rng) {
+    int a = rng->Range(2, 16);
+    int b = rng->Range(64, 256);
+    return rng->Range(0, 1) ? MakeRect(a, b) : MakeRect(b, a);
+}
+
+static PackRect Mixed(Random *rng) {
+    switch (rng->Range(0, 3)) {
+    case 0: return Uniform(rng);
+    case 1: return PowerLaw(rng);
+    case 2: return Tile(rng);
+    default: return TallThin(rng);
+    }
+}
+
+static bool MakeSynthetic(const std::string &dist, size_t count,
+                          uint32_t seed, Corpus *corpus) {
+    PackRect (*fn)(Random *) = nullptr;
+    if (dist == "uniform") fn = &Uniform;
+    if (dist == "power") fn = &PowerLaw;
+    if (dist == "tiles") fn = &Tile;
+    if (dist == "tall") fn = &TallThin;
+    if (dist == "mixed") fn = &Mixed;
+    if (fn == nullptr) return false;
+
+    Random rng(seed);
+    corpus->name = dist;
+    corpus->rects.resize(count);
+    for (auto &rect : corpus->rects) {
+        rect = fn(&rng);
+    }
+    return true;
+}
+
+static bool HasExtension(const std::string &filename, const char *ext) {
+    size_t n = strlen(ext);
+    return filename.size() >= n
+        && filename.compare(filename.size() - n, n, ext) == 0;
+}
+
+// Reads the sprite sizes of each atlas in a project from the image
+// headers. Text files are read as one "w h" pair per line instead.
+static bool ReadReplay(const std::string &filename,
+                       std::vector<Corpus> *corpora) {
+    std::ifstream file(filename);
+    if (!file) return false;
+
+    if (!HasExtension(filename, ".spritepack")) {
+        Corpus corpus;
+        corpus.name = filename;
+        int w, h;
+        while (file >> w >> h) {
+            corpus.rects.push_back(MakeRect(w, h));
+        }
+        corpora->push_back(std::move(corpus));
+        return true;
+    }
+
+    auto sep = filename.find_last_of("/\\");
+    auto base = sep == std::string::npos ? "" : filename.substr(0, sep + 1);
+    std::vector<std::string> sprites;
+    int padding = 0;
+
+    auto add_atlas = [&]() {
+        if (sprites.size() == 0) return;
+        Corpus corpus;
+        corpus.name = filename + "#" + std::to_string(corpora->size());
+        for (const auto &sprite : sprites) {
+            int w, h, comp;
+            if (!stbi_info(sprite.c_str(), &w, &h, &comp)) {
+                fprintf(stderr, "error: Failed to read %s\n", sprite.c_str());
+                continue;
+            }
+            corpus.rects.push_back(MakeRect(w + padding*2, h + padding*2));
+        }
+        corpora->push_back(std::move(corpus));
+        sprites.clear();
+        padding = 0;
+    };
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.size() > 0 && line.back() == '\r') line.pop_back();
+        auto space = line.find(' ');
+        if (space == std::string::npos) continue;
+        auto key = line.substr(0, space);
+        auto value = line.substr(space + 1);
+
+        if (key == "atlas") add_atlas();
+        if (key == "sprite") sprites.push_back(base + value);
+        if (key == "padding") padding = atoi(value.c_str());
+    }
+    add_atlas();
+    return true;
+}
+
+static Result Run(const Corpus &corpus, const Heuristic &heur, int runs) {
+    Result result;
+    result.corpus = corpus.name;
+    result.heuristic = heur.name;
+    result.count = corpus.rects.size();
+
+    std::vector<double> times;
+    for (int i = 0; i < runs; ++i) {
+        auto rects = corpus.rects;
+        auto begin = std::chrono::steady_clock::now();
+        if (heur.compare != nullptr) {
+            std::stable_sort(rects.begin(), rects.end(), heur.compare);
+        }
+        spack::PackStats stats;
+        auto size = spack::PackRects(&rects, heur.square, &stats);
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(
+            std::chrono::duration<double, std::milli>(end - begin).count());
+
+        int64_t area = 0;
+        for (const auto &rect : rects) {
+            area += int64_t(rect.w) * rect.h;
+        }
+        result.width = size.w;
+        result.height = size.h;
+        result.occupancy = double(area) / (int64_t(size.w) * size.h);
+        result.retries = stats.retries;
+        result.peak_mask_bytes = stats.peak_mask_bytes;
+    }
+    // Median is less sensitive to other processes than the mean
+    std::sort(times.begin(), times.end());
+    result.time_ms = times[times.size() / 2];
+    return result;
+}
+
+static const char *CsvHeader =
+    "corpus,count,heuristic,width,height,occupancy,retries,"
+    "peak_mask_bytes,time_ms\n";
+
+static void WriteResult(FILE *file, const Result &r) {
+    fprintf(file, "%s,%zu,%s,%d,%d,%.6f,%d,%zu,%.3f\n",
+            r.corpus.c_str(), r.count, r.heuristic.c_str(), r.width,
+            r.height, r.occupancy, r.retries, r.peak_mask_bytes, r.time_ms);
+}
+
+static bool ReadResults(const char *filename, std::vector<Result> *results) {
+    std::ifstream file(filename);
+    if (!file) return false;
+
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        std::stringstream fields(line);
+        std::vector<std::string> f;
+        std::string field;
+        while (std::getline(fields, field, ',')) f.push_back(field);
+        if (f.size() != 9) continue;
+
+        Result r;
+        r.corpus = f[0];
+        r.count = strtoull(f[1].c_str(), nullptr, 10);
+        r.heuristic = f[2];
+        r.width = atoi(f[3].c_str());
+        r.height = atoi(f[4].c_str());
+        r.occupancy = atof(f[5].c_str());
+        r.retries = atoi(f[6].c_str());
+        r.peak_mask_bytes = strtoull(f[7].c_str(), nullptr, 10);
+        r.time_ms = atof(f[8].c_str());
+        results->push_back(r);
+    }
+    return true;
+}
+
+static std::string ResultKey(const Result &r) {
+    return r.corpus + "," + std::to_string(r.count) + "," + r.heuristic;
+}
+
+// Layouts must match exactly, times may be slower by the tolerance.
+static bool CompareResults(const std::vector<Result> &results,
+                           const std::vector<Result> &baseline,
+                           double tolerance) {
+    // Times this small are mostly noise
+    constexpr double MinTimeMs = 0.1;
+    std::unordered_map<std::string, const Result *> base;
+    for (const auto &r : baseline) base[ResultKey(r)] = &r;
+
+    bool ok = true;
+    for (const auto &r : results) {
+        auto it = base.find(ResultKey(r));
+        if (it == base.end()) continue;
+        const auto &b = *it->second;
+        if (r.width != b.width || r.height != b.height
+                || r.retries != b.retries) {
+            fprintf(stderr, "regression: %s layout %dx%d (%d retries), "
+                    "baseline %dx%d (%d retries)\n", ResultKey(r).c_str(),
+                    r.width, r.height, r.retries, b.width, b.height,
+                    b.retries);
+            ok = false;
+        }
+        if (r.time_ms > MinTimeMs
+                && r.time_ms > b.time_ms * (1.0 + tolerance)) {
+            fprintf(stderr, "regression: %s %.3fms, baseline %.3fms\n",
+                    ResultKey(r).c_str(), r.time_ms, b.time_ms);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static std::vector<std::string> SplitList(const char *list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item != "") items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char *argv[]) {
+    auto dists = SplitList("uniform,power,tiles,tall,mixed");
+    auto counts = SplitList("100");
+    std::vector<std::string> replays;
+    int runs = 3;
+    uint32_t seed = 1;
+    const char *csv_file = nullptr;
+    const char *baseline_file = nullptr;
+    double tolerance = 0.1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-dist") == 0 && i + 1 < argc) {
+            dists = SplitList(argv[++i]);
+        } else if (strcmp(argv[i], "-count") == 0 && i + 1 < argc) {
+            counts = SplitList(argv[++i]);
+        } else if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+            runs = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+            replays.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc) {
+            csv_file = argv[++i];
+        } else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) {
+            baseline_file = argv[++i];
+        } else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "error: Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<Corpus> corpora;
+    for (const auto &dist : dists) {
+        for (const auto &count : counts) {
+            Corpus corpus;
+            size_t n = strtoull(count.c_str(), nullptr, 10);
+            if (!MakeSynthetic(dist, n, seed, &corpus)) {
+                fprintf(stderr, "error: Unknown distribution %s\n",
+                        dist.c_str());
+                return 1;
+            }
+            corpora.push_back(std::move(corpus));
+        }
+    }
+    for (const auto &replay : replays) {
+        if (!ReadReplay(replay, &corpora)) {
+            fprintf(stderr, "error: Failed to read %s\n", replay.c_str());
+            return 1;
+        }
+    }
+
+    FILE *csv = nullptr;
+    if (csv_file != nullptr && (csv = fopen(csv_file, "w+")) == nullptr) {
+        fprintf(stderr, "error: Failed to write %s\n", csv_file);
+        return 1;
+    }
+    printf("%s", CsvHeader);
+    if (csv != nullptr) fprintf(csv, "%s", CsvHeader);
+
+    std::vector<Result> results;
+    for (const auto &corpus : corpora) {
+        if (corpus.rects.size() == 0) continue;
+        for (const auto &heur : heuristics) {
+            results.push_back(Run(corpus, heur, runs));
+            WriteResult(stdout, results.back());
+            if (csv != nullptr) WriteResult(csv, results.back());
+            fflush(stdout);
+        }
+    }
+    if (csv != nullptr) fclose(csv);
+
+    if (baseline_file != nullptr) {
+        std::vector<Result> baseline;
+        if (!ReadResults(baseline_file, &baseline)) {
+            fprintf(stderr, "error: Failed to read %s\n", baseline_file);
+            return 1;
+        }
+        return CompareResults(results, baseline, tolerance) ? 0 : 1;
+    }
+    return 0;
+}
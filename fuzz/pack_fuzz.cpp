@@ -0,0 +1,131 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+// Packs random sprite sets in the production packing order, with and
+// without square atlases, and checks the layouts with ValidateLayout,
+// aborting on the first invalid layout.
+//
+// Built as a libFuzzer target with -DSPACK_LIBFUZZER=ON using clang,
+// otherwise as a standalone executable that runs the given input files,
+// or random inputs if there are none:
+//
+//   spritepacker_fuzz [-runs 1000] [-seed 1] [input files...]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <iterator>
+
+#include "pack.h"
+
+using spack::PackRect;
+
+// The first byte is the padding, followed by a width, height and animation
+// group byte for each sprite. Sprites are packed in the same order as
+// Atlas::SortRenderSprites puts them in.
+static void PackAndCheck(const uint8_t *data, size_t size) {
+    constexpr size_t MaxSprites = 64;
+    constexpr int MaxSide = 32;
+    constexpr int MaxGroups = 4;
+    if (size < 4) return;
+
+    int padding = data[0] % 4;
+    std::vector<PackRect> input;
+    std::vector<spack::PackOrderKey> keys;
+    for (size_t i = 1; i + 2 < size && input.size() < MaxSprites; i += 3) {
+        PackRect rect;
+        rect.w = data[i] % MaxSide + 1 + padding * 2;
+        rect.h = data[i + 1] % MaxSide + 1 + padding * 2;
+        keys.push_back(spack::MakePackOrderKey(data[i + 2] % MaxGroups,
+                                               rect.w, rect.h,
+                                               uint32_t(input.size())));
+        input.push_back(rect);
+    }
+    spack::SortPackOrder(&keys);
+
+    for (bool square : {false, true}) {
+        std::vector<PackRect> rects;
+        rects.reserve(keys.size());
+        for (const auto &key : keys) {
+            rects.push_back(input[key.row]);
+        }
+        auto atlas = spack::PackRects(&rects, square);
+        std::string error;
+        if (!spack::ValidateLayout(rects, atlas, &error)) {
+            fprintf(stderr, "error: Invalid %dx%d layout of %zu sprites"
+                    " (square %d): %s\n", atlas.w, atlas.h, rects.size(),
+                    int(square), error.c_str());
+            abort();
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    PackAndCheck(data, size);
+    return 0;
+}
+
+#ifndef SPACK_LIBFUZZER
+
+int main(int argc, char *argv[]) {
+    int runs = 1000;
+    uint32_t seed = 1;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    for (const auto &filename : files) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "error: Failed to read %s\n", filename.c_str());
+            return 1;
+        }
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+        PackAndCheck(data.data(), data.size());
+    }
+    if (files.size() > 0) {
+        printf("%zu inputs ok\n", files.size());
+        return 0;
+    }
+
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> data;
+    for (int i = 0; i < runs; ++i) {
+        data.resize(4 + rng() % 192);
+        for (auto &byte : data) byte = uint8_t(rng());
+        PackAndCheck(data.data(), data.size());
+    }
+    printf("%d inputs ok\n", runs);
+    return 0;
+}
+
+#endif // SPACK_LIBFUZZER
@@ -22,225 +22,781 @@
 #include <string>
 #include <algorithm>
 #include <cassert>
-#include <cstring>
 #include <cmath>
+#include <filesystem>
 
 #include "SDL.h"
 #include "image.h"
+#include "jobs.h"
+#include "manifest.h"
+#include "pack.h"
+#include "profile.h"
 
 namespace spack {
 
-static uint32_t NextPow2(uint32_t value) {
-    --value;
-    value |= value >> 1;
-    value |= value >> 2;
-    value |= value >> 4;
-    value |= value >> 8;
-    value |= value >> 16;
-    return value + 1;
-}
+// Copy of an atlas rendered on a worker thread
+struct AtlasJob {
+    std::unique_ptr<Atlas> atlas;
+    // Atlas::version the copy was made from
+    uint64_t version = 0;
+    int sprites = 0;
+    std::atomic<bool> cancel{false};
+    std::atomic<int> drawn{0};
+    std::atomic<bool> done{false};
+};
 
 Atlas::~Atlas() {
+    CancelUpdate();
     // Make sure atlas destructor is not called after SDL_DestroyRenderer!
-    if (device != nullptr && texture != nullptr) {
-        SDL_DestroyTexture(texture);
-        FreeSpriteTextures(sprites);
-        FreeSpriteTextures(render_sprites);
-    }
 }
 
 void Atlas::CreateTexture(int w, int h) {
-    if (texture != nullptr) {
-        SDL_DestroyTexture(texture);
-    }
-    texture = SDL_CreateTexture(device,
-                                SDL_PIXELFORMAT_RGBA32,
-                                SDL_TEXTUREACCESS_TARGET,
-                                w, h);
-    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-    SDL_SetRenderTarget(device, texture);
-    SDL_SetRenderDrawColor(device, 0, 0, 0, 0);
-    SDL_RenderClear(device);
-    SDL_SetRenderTarget(device, nullptr);
+    ClearImage(&image, w, h);
+    exported_layout = 0;
     width = w;
     height = h;
+    MarkTextureDirty();
 }
 
-// Returns approximate power of 2 packing size
-// This size assumes sprites can be packed without any wasted space,
-// which may not be the case so min_h is a heuristic value used to
-// adjust the height until all sprites fit.
-SDL_Point Atlas::PackedSize(int heur, int n) const {
-    int area = 0;
-    int max_w = 0;
-    int max_h = 0;
+void Atlas::MarkTextureDirty() {
+    texture_dirty = true;
+}
 
-    for (const auto &sprite : render_sprites) {
-        area += sprite.src.w * sprite.src.h;
-        max_w = std::max(max_w, sprite.src.w);
-        max_h = std::max(max_h, sprite.src.h);
+AtlasPreview *Atlas::Preview() {
+    if (device == nullptr) {
+        return nullptr;
     }
-
-    int a = ceilf(sqrtf(area));
-    int w = NextPow2(std::max(a, max_w));
-    int h = NextPow2(std::max(std::max(a, heur), max_h));
-
-    if (square_texture) {
-        return SDL_Point{h, h};
+    if (preview == nullptr) {
+        preview = std::make_unique<AtlasPreview>(device);
+    }
+    if (texture_dirty) {
+        preview->Invalidate();
+        texture_dirty = false;
     }
+    return preview.get();
+}
 
-    // Try to use half the width
-    if (n <= 1 && w == h && (w / 2) * h > area) {
-        w /= 2;
+SDL_Texture *Atlas::SpriteThumbnail(size_t index, SDL_FRect *uv) {
+    if (device == nullptr) {
+        return nullptr;
     }
+    if (thumbnails == nullptr) {
+        thumbnails = std::make_unique<ThumbnailAtlas>(device);
+    }
+    return thumbnails->Get(sprites.HandleAt(index), sprites[index], uv);
+}
 
-    // Try to use half the height. This is used to correct a
-    // mistake that can be made by halving the width, where half the
-    // width causes more wasted space. We stop if n > 1 and assume
-    // this is not possible.
-    if (n <= 1 && w != h && (h / 2) * w > area) {
-        h /= 2;
+std::vector<uint32_t> Atlas::ExportOrder() const {
+    std::vector<uint32_t> order;
+    order.reserve(sprites.size());
+    for (const auto &anim : animations) {
+        for (auto frame : anim.frames) {
+            order.push_back(uint32_t(sprites.IndexOf(frame)));
+        }
     }
-    return SDL_Point{w, h};
+    // Every sprite is a frame of one animation
+    assert(order.size() == sprites.size());
+    return order;
 }
 
 void Atlas::SortRenderSprites() {
-    // Sprites need to be in order so we can index them by frame
-    std::sort(render_sprites.begin(), render_sprites.end(),
-        [](const RenderSprite &a, const RenderSprite &b) {
-            return a.sorting_order < b.sorting_order;
-        });
+    SPACK_PROFILE("sort");
+    size_t n = layout.size();
+    assert(n == sprites.size());
+    if (n == 0) return;
 
+    // Animation and export position of each sprite, see ExportOrder
+    std::vector<uint32_t> group(n, 0);
+    std::vector<uint32_t> position(n, 0);
+    uint32_t next = 0;
     for (size_t i = 0; i < animations.size(); ++i) {
-        for (int frame : animations[i].frames) {
-            render_sprites[frame].animation_group = i;
+        for (auto frame : animations[i].frames) {
+            size_t index = sprites.IndexOf(frame);
+            group[index] = i;
+            position[index] = next++;
         }
     }
+    assert(next == n);
 
-    // Keep sprites from the same animation group together
-    std::sort(render_sprites.begin(), render_sprites.end(),
-        [](const RenderSprite &a, const RenderSprite &b) {
-            return a.animation_group < b.animation_group;
-        });
+    // Keys start out in export order and the sort is stable, so sprites
+    // of the same area keep their order and the result depends neither on
+    // the order of the previous pack nor on which sprites were removed.
+    std::vector<PackOrderKey> keys(n);
+    for (size_t row = 0; row < n; ++row) {
+        size_t i = layout.sprite[row];
+        layout.group[row] = group[i];
+        keys[position[i]] = MakePackOrderKey(group[i], layout.w[row],
+                                             layout.h[row], uint32_t(row));
+    }
+    SortPackOrder(&keys);
 
-    std::sort(render_sprites.begin(), render_sprites.end(),
-        [](const RenderSprite &a, const RenderSprite &b) {
-            bool can_sort = a.animation_group == b.animation_group;
-            return can_sort && a.src.w * a.src.h > b.src.w * b.src.h;
-        });
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = keys[i].row;
+    }
+    layout.Permute(order);
+    rows_sorted = true;
+    FinishStage(Stage_Sort);
 }
 
-SDL_Point Atlas::Pack(int heur, int n) {
-    assert(n < 512);
-    SortRenderSprites();
+SDL_Point Atlas::Pack() {
+    std::vector<PackRect> rects(layout.size());
+    for (size_t i = 0; i < rects.size(); ++i) {
+        rects[i].w = layout.w[i];
+        rects[i].h = layout.h[i];
+    }
+    PackStats pack_stats;
+    auto size = PackRects(&rects, square_texture, &pack_stats);
+    for (size_t i = 0; i < rects.size(); ++i) {
+        layout.x[i] = rects[i].x;
+        layout.y[i] = rects[i].y;
+    }
+    stats.pack_retries = pack_stats.retries;
+    stats.peak_mask_bytes = pack_stats.peak_mask_bytes;
+    FinishStage(Stage_Pack);
+    return SDL_Point{size.w, size.h};
+}
 
-    auto size = PackedSize(heur, n);
-    auto *mask = new unsigned char[size.x * size.y];
-    memset(mask, 0, size.x * size.y);
-
-    for (auto &sprite : render_sprites) {
-        int ox = 0;
-        int oy = 0;
-        bool packed = false;
-        for (oy = 0; ; ++oy) {
-            if (oy + sprite.src.h > size.y) {
-                // Need more space
-                delete[] mask;
-                return Pack(size.y + 1, ++n);
-            }
-            for (ox = 0; ox <= size.x - sprite.src.w; ++ox) {
-                unsigned char c = 0;
-                // Rect collisions
-                c |= mask[ox + oy * size.x];
-                c |= mask[ox + (oy + sprite.src.h - 1) * size.x];
-                c |= mask[(ox + sprite.src.w - 1) + oy * size.x];
-                c |= mask[(ox+sprite.src.w-1) + (oy+sprite.src.h-1)*size.x];
-                if (c == 0) {
-                    packed = true;
-                    break;
-                }
-            }
-            if (packed) break;
+bool Atlas::Composite(int w, int h) {
+    SPACK_PROFILE("composite");
+    CreateTexture(w, h);
+    bool ok = true;
+    for (size_t row = 0; row < layout.size(); ++row) {
+        size_t i = layout.sprite[row];
+        if (Cancelled()) return false;
+        if (!LoadSpriteToDraw(i)) {
+            ok = false;
+            continue;
         }
-        for (int y = oy; y < oy + sprite.src.h; ++y) {
-            for (int x = ox; x < ox + sprite.src.w; ++x) {
-                mask[x + y * size.x] = 255;
-            }
+        DrawSprite(&image, sprites[i], layout.x[row], layout.y[row],
+                   padding, padding_mode);
+        if (stream_sprites) UnloadSprite(i);
+        if (drawn != nullptr) ++*drawn;
+    }
+    MarkTextureDirty();
+    FinishStage(Stage_Composite);
+    return ok;
+}
+
+void Atlas::FinishStage(AtlasStage stage) {
+    // Stages after this one are the bits above it
+    dirty_stages &= ~uint32_t(stage);
+    dirty_stages |= Stage_All & ~(uint32_t(stage) * 2 - 1);
+}
+
+void Atlas::Invalidate(AtlasStage stage) {
+    if (stage == Stage_Pack && !rows_sorted) {
+        // Removing sprites moved rows out of packing order
+        stage = Stage_Sort;
+    }
+    if (stage != Stage_None) {
+        dirty_stages |= Stage_All & ~(uint32_t(stage) - 1);
+        ++version;
+    }
+}
+
+bool Atlas::Update() {
+    if (dirty_stages & Stage_Pad) {
+        RenderSprites();
+    }
+    if (layout.size() == 0) {
+        stats = AtlasStats{};
+        dirty_stages = Stage_None;
+        return true;
+    }
+    bool packed = dirty_stages & Stage_Pack;
+    if (dirty_stages & Stage_Sort) {
+        SortRenderSprites();
+    }
+    SDL_Point size{width, height};
+    if (!Cancelled() && (dirty_stages & Stage_Pack)) {
+        size = Pack();
+    }
+    if (Cancelled()) return false;
+    bool ok = true;
+    if (dirty_stages & Stage_Composite) {
+        ok = Composite(size.x, size.y);
+    }
+    UpdateStats(packed ? false : stats.cached_layout);
+    assert(ValidateLayout());
+    return ok;
+}
+
+bool Atlas::Render() {
+    Invalidate(Stage_Sort);
+    return Update();
+}
+
+bool Atlas::Cancelled() const {
+    return cancel != nullptr && *cancel;
+}
+
+std::unique_ptr<Atlas> Atlas::Snapshot() const {
+    auto copy = std::make_unique<Atlas>(nullptr);
+    copy->width = width;
+    copy->height = height;
+    copy->sprites = sprites;
+    copy->animations = animations;
+    copy->sources = sources;
+    copy->stats = stats;
+    copy->padding = padding;
+    copy->padding_mode = padding_mode;
+    copy->square_texture = square_texture;
+    copy->layout = layout;
+    copy->rows_sorted = rows_sorted;
+    copy->dirty_stages = dirty_stages;
+    return copy;
+}
+
+void Atlas::TakeUpdate(Atlas *done) {
+    layout = std::move(done->layout);
+    rows_sorted = done->rows_sorted;
+    stats = done->stats;
+    dirty_stages = done->dirty_stages;
+    if (layout.size() > 0) {
+        width = done->width;
+        height = done->height;
+        image = std::move(done->image);
+        exported_layout = 0;
+        MarkTextureDirty();
+    }
+    // Keep the sprites the copy had to load
+    for (size_t i = 0; i < sprites.size(); ++i) {
+        auto &sprite = sprites[i];
+        if (sprite.image == nullptr) {
+            sprite.image = done->sprites[i].image;
+            sprite.rect = done->sprites[i].rect;
         }
-        sprite.dst = SDL_Rect{ox, oy, sprite.src.w, sprite.src.h};
     }
-    delete[] mask;
-    return size;
 }
 
-void Atlas::Render() {
-    if (render_sprites.size() == 0) {
+void Atlas::UpdateInBackground(ThreadPool *worker) {
+    if (job != nullptr && job->done) {
+        if (job->version == version) {
+            TakeUpdate(job->atlas.get());
+        }
+        job = nullptr;
+    }
+    if (dirty_stages == Stage_None || imports.size() > 0
+            || (job != nullptr && job->version == version)) {
         return;
     }
-    auto size = Pack();
-    if (size.x != width || size.y != height) {
-        CreateTexture(size.x, size.y);
+    // The update already running was superseded by an edit
+    CancelUpdate();
+    job = std::make_shared<AtlasJob>();
+    job->version = version;
+    job->sprites = int(sprites.size());
+    job->atlas = Snapshot();
+    job->atlas->cancel = &job->cancel;
+    job->atlas->drawn = &job->drawn;
+    worker->Run([job = job] {
+        if (!job->cancel) job->atlas->Update();
+        job->done = true;
+    });
+}
+
+void Atlas::CancelUpdate() {
+    if (job != nullptr) {
+        job->cancel = true;
+        job = nullptr;
     }
-    SDL_SetRenderTarget(device, texture);
-    SDL_SetRenderDrawColor(device, 0, 0, 0, 0);
-    SDL_RenderClear(device);
+}
 
-    for (const auto &sprite : render_sprites) {
-        SDL_RenderCopy(device, sprite.texture,
-                       &sprite.src, &sprite.dst);
+float Atlas::UpdateProgress() const {
+    if (job == nullptr || job->sprites == 0) {
+        return 0.0f;
     }
-    SDL_SetRenderTarget(device, nullptr);
+    return float(job->drawn) / float(job->sprites);
+}
+
+static bool ValidateRenderLayout(const SlotMap<Sprite> &sprites,
+                                 const RenderLayout &layout,
+                                 int padding, int w, int h,
+                                 std::string *error) {
+    std::vector<PackRect> rects(layout.size());
+    for (size_t i = 0; i < layout.size(); ++i) {
+        const auto &sprite = sprites[layout.sprite[i]];
+        if (layout.w[i] != sprite.rect.w + padding * 2
+                || layout.h[i] != sprite.rect.h + padding * 2) {
+            if (error != nullptr) {
+                *error = sprite.filename + " does not have "
+                    + std::to_string(padding) + "px of padding";
+            }
+            return false;
+        }
+        rects[i] = PackRect{layout.w[i], layout.h[i], layout.x[i], layout.y[i]};
+    }
+    return spack::ValidateLayout(rects, PackSize{w, h}, error);
+}
+
+bool Atlas::ValidateLayout(std::string *error) const {
+    return ValidateRenderLayout(sprites, layout, padding,
+                                width, height, error);
+}
+
+void Atlas::UpdateStats(bool cached_layout) {
+    stats.width = width;
+    stats.height = height;
+    stats.sprites = int(sprites.size());
+    stats.sprite_area = 0;
+    stats.padded_area = 0;
+    for (size_t i = 0; i < layout.size(); ++i) {
+        const auto &rect = sprites[layout.sprite[i]].rect;
+        stats.sprite_area += int64_t(rect.w) * rect.h;
+        stats.padded_area += int64_t(layout.w[i]) * layout.h[i];
+    }
+    stats.cached_layout = cached_layout;
+    if (cached_layout) {
+        stats.pack_retries = 0;
+        stats.peak_mask_bytes = 0;
+    }
+}
+
+static bool LoadCachedImage(const Manifest &cache,
+                            const std::string &filename, Image *image) {
+    if (!IsLossless(cache.image_format)) {
+        return false;
+    }
+    for (const auto &out : cache.outputs) {
+        uint64_t hash;
+        if (out.filename != filename) continue;
+        // Make sure the image was not modified since it was exported
+        if (!HashFile(filename, &hash) || hash != out.hash) {
+            return false;
+        }
+        return LoadImage(filename, image)
+            && image->width == cache.width
+            && image->height == cache.height;
+    }
+    return false;
+}
+
+bool Atlas::RenderCached(const Manifest &cache) {
+    size_t n = sprites.size();
+    if (n == 0 || cache.inputs.size() != n || cache.layout.size() != n) {
+        return false;
+    }
+
+    // Manifest inputs and positions are in export order
+    auto order = ExportOrder();
+    std::vector<size_t> position(n);
+    std::vector<bool> dirty(n);
+    for (size_t k = 0; k < n; ++k) {
+        size_t i = order[k];
+        position[i] = k;
+        auto &sprite = sprites[i];
+        const auto &in = cache.inputs[k];
+        dirty[i] = !IsInputUnchanged(in, sprite.filename);
+
+        if (dirty[i]) {
+            // Sprite may still be loaded from before it changed
+            UnloadSprite(i);
+            if (!IsSheetCell(i) && !ReadImageSize(sprite.filename,
+                                                  &sprite.rect.w,
+                                                  &sprite.rect.h)) {
+                return false;
+            }
+            continue;
+        }
+        if (sprite.image == nullptr && !IsSheetCell(i)) {
+            // Only the sprite size is needed to check the layout
+            sprite.rect = SDL_Rect{0, 0, in.width, in.height};
+        }
+    }
+    if (HashAtlasLayout(*this) != cache.layout_hash) {
+        return false;
+    }
+
+    RenderSprites();
+    for (size_t i = 0; i < layout.size(); ++i) {
+        const auto &pos = cache.layout[position[layout.sprite[i]]];
+        layout.x[i] = pos.x;
+        layout.y[i] = pos.y;
+    }
+    // Rows are kept in packing order in case only the packing options
+    // change later
+    SortRenderSprites();
+    // Invalid layouts, such as overlapping layouts exported by older
+    // versions or manifests edited by hand, are packed again.
+    if (!ValidateRenderLayout(sprites, layout, padding,
+                              cache.width, cache.height, nullptr)) {
+        return false;
+    }
+
+    Image previous;
+    bool same_pixels = cache.padding_mode == padding_mode;
+    if (same_pixels && exported_layout == cache.layout_hash
+            && width == cache.width && height == cache.height) {
+        // Image in memory is still the one that was last exported
+    } else if (same_pixels
+            && LoadCachedImage(cache, OutputPath(output_image), &previous)) {
+        width = cache.width;
+        height = cache.height;
+        image = std::move(previous);
+    } else {
+        // Layout is still valid but every sprite needs to be drawn
+        width = cache.width;
+        height = cache.height;
+        exported_layout = 0;
+        UpdateStats(true);
+        dirty_stages = Stage_Composite;
+        return true;
+    }
+
+    SPACK_PROFILE("composite");
+    for (size_t row = 0; row < layout.size(); ++row) {
+        size_t i = layout.sprite[row];
+        if (!dirty[i]) continue;
+
+        if (!LoadSpriteToDraw(i)) {
+            // Sprite changed again since we checked its size
+            return false;
+        }
+        DrawSprite(&image, sprites[i], layout.x[row], layout.y[row],
+                   padding, padding_mode);
+        if (stream_sprites) UnloadSprite(i);
+    }
+    exported_layout = 0;
+    MarkTextureDirty();
+    UpdateStats(true);
+    dirty_stages = Stage_None;
+    return true;
 }
 
 void Atlas::RenderSprites() {
-    FreeSpriteTextures(render_sprites);
-    render_sprites.clear();
-    render_sprites.reserve(sprites.size());
+    SPACK_PROFILE("padding");
+    layout.clear();
+    layout.reserve(sprites.size());
     for (size_t i = 0; i < sprites.size(); ++i) {
-        auto rs = MakeRenderSprite(device, sprites[i], padding, padding_mode);
-        rs.sorting_order = i;
-        render_sprites.push_back(std::move(rs));
+        const auto &rect = sprites[i].rect;
+        layout.Append(i, rect.w + padding * 2, rect.h + padding * 2);
     }
+    FinishStage(Stage_Pad);
 }
 
 void Atlas::AppendSprite(const Sprite &sprite, int anim) {
     assert(animations.size() > 0);
-    assert(anim >= 0 && anim < animations.size());
+    assert(anim >= 0 && size_t(anim) < animations.size());
 
-    auto rs = MakeRenderSprite(device, sprite, padding, padding_mode);
-    rs.sorting_order = sprites.size();
-    animations[anim].frames.push_back(sprites.size());
-    sprites.push_back(sprite);
-    render_sprites.push_back(std::move(rs));
+    layout.Append(sprites.size(), sprite.rect.w + padding * 2,
+                  sprite.rect.h + padding * 2);
+    animations[anim].frames.push_back(sprites.Insert(sprite));
+    Invalidate(Stage_Sort);
 }
 
 bool Atlas::AppendSprite(const std::string &filename, int anim) {
-    auto sprite = LoadSprite(device, filename);
+    auto sprite = LoadSprite(filename);
     if (!sprite.has_value())
         return false;
     AppendSprite(sprite.value(), anim);
     return true;
 }
 
-bool Atlas::Export(AtlasExporter fn) {
+void Atlas::AppendSpriteFile(const std::string &filename, int anim) {
+    assert(animations.size() > 0);
+    assert(anim >= 0 && size_t(anim) < animations.size());
+
+    animations[anim].frames.push_back(sprites.Insert(MakeSpriteRef(filename)));
+    Invalidate(Stage_Pad);
+}
+
+void Atlas::ImportSprite(ThreadPool *workers, const std::string &filename,
+                         int anim) {
+    auto import = std::make_shared<SpriteImport>();
+    import->filename = filename;
+    import->anim = anim;
+    imports.push_back(import);
+    ++import_batch;
+    workers->Run([import] {
+        import->sprite = LoadSprite(import->filename);
+        import->done = true;
+    });
+}
+
+std::vector<std::string> Atlas::FinishImports() {
+    std::vector<std::string> failed;
+    while (imports.size() > 0 && imports.front()->done) {
+        auto import = std::move(imports.front());
+        imports.pop_front();
+        if (!import->sprite.has_value()) {
+            failed.push_back(import->filename);
+            continue;
+        }
+        AppendSprite(import->sprite.value(), import->anim);
+    }
+    if (imports.size() == 0) {
+        import_batch = 0;
+    }
+    return failed;
+}
+
+void Atlas::StreamSprite(ThreadPool *workers, size_t index) {
+    if (sprites[index].image != nullptr) {
+        return;
+    }
+    auto handle = sprites.HandleAt(index);
+    for (const auto &load : sprite_loads) {
+        if (load->handle == handle) return;
+    }
+    auto load = std::make_shared<SpriteLoad>();
+    load->handle = handle;
+    load->filename = sprites[index].filename;
+    sprite_loads.push_back(load);
+    workers->Run([load] {
+        load->sprite = LoadSprite(load->filename);
+        load->done = true;
+    });
+}
+
+void Atlas::FinishSpriteLoads() {
+    auto end = std::remove_if(sprite_loads.begin(), sprite_loads.end(),
+        [this](const std::shared_ptr<SpriteLoad> &load) {
+            if (!load->done) return false;
+            if (!sprites.Contains(load->handle)) return true;
+            // Failed loads are kept so they are not queued again
+            if (!load->sprite.has_value()) return false;
+
+            size_t index = sprites.IndexOf(load->handle);
+            if (sprites[index].image != nullptr) return true;
+            auto size = sprites[index].rect;
+            if (SetSpriteImage(index, std::move(*load->sprite))
+                    && (sprites[index].rect.w != size.w
+                        || sprites[index].rect.h != size.h)) {
+                // File changed size since the atlas was opened
+                Invalidate(Stage_Pad);
+            }
+            return true;
+        });
+    sprite_loads.erase(end, sprite_loads.end());
+}
+
+bool Atlas::IsStreaming() const {
+    for (const auto &load : sprite_loads) {
+        if (!load->done) return true;
+    }
+    return false;
+}
+
+static void ClearRect(Image *image, const SDL_Rect &rect) {
+    if (rect.x < 0 || rect.y < 0 || rect.x + rect.w > image->width
+            || rect.y + rect.h > image->height) {
+        return;
+    }
+    for (int y = rect.y; y < rect.y + rect.h; ++y) {
+        auto *row = &image->pixels[(size_t(y) * image->width + rect.x) * 4];
+        std::fill(row, row + size_t(rect.w) * 4, 0);
+    }
+}
+
+void Atlas::EraseSprite(SpriteHandle handle) {
+    ++version;
+    size_t index = sprites.IndexOf(handle);
+    size_t last = sprites.size() - 1;
+    UnloadSprite(index);
+
+    int removed = layout.RowOf(index);
+    if (removed >= 0) {
+        const auto &rect = sprites[index].rect;
+        stats.sprite_area -= int64_t(rect.w) * rect.h;
+        stats.padded_area -= int64_t(layout.w[removed]) * layout.h[removed];
+        ClearRect(&image, layout.Rect(removed));
+        layout.SwapErase(removed);
+        rows_sorted = false;
+        if (dirty_stages & Stage_Pack) {
+            dirty_stages |= Stage_Sort;
+        }
+    }
+    // The last sprite takes the place of the removed one
+    layout.MoveSprite(last, index);
+    sprites.Remove(handle);
+    stats.sprites = int(sprites.size());
+}
+
+void Atlas::RemoveSprite(size_t anim, size_t frame) {
+    auto &frames = animations[anim].frames;
+    auto handle = frames[frame];
+    frames.erase(frames.begin() + frame);
+    EraseSprite(handle);
+    exported_layout = 0;
+    MarkTextureDirty();
+}
+
+void Atlas::RemoveAnimation(size_t index) {
+    for (auto frame : animations[index].frames) {
+        EraseSprite(frame);
+    }
+    animations.erase(animations.begin() + index);
+    for (auto &source : sources) {
+        if (source.anim == int(index)) {
+            source.anim = -1;
+        } else if (source.anim > int(index)) {
+            --source.anim;
+        }
+    }
+    for (auto &import : imports) {
+        if (size_t(import->anim) == index) {
+            import->anim = 0;
+        } else if (size_t(import->anim) > index) {
+            --import->anim;
+        }
+    }
+    exported_layout = 0;
+    MarkTextureDirty();
+}
+
+void Atlas::UnloadSprite(size_t index) {
+    if (thumbnails != nullptr) {
+        thumbnails->Remove(sprites.HandleAt(index));
+    }
+    sprites[index].image = nullptr;
+}
+
+bool Atlas::LoadSpriteImage(size_t index) {
+    auto &sprite = sprites[index];
+    if (sprite.image != nullptr) {
+        return true;
+    }
+    auto loaded = LoadSprite(sprite.filename);
+    return loaded.has_value() && SetSpriteImage(index, std::move(*loaded));
+}
+
+bool Atlas::SetSpriteImage(size_t index, Sprite &&loaded) {
+    auto &sprite = sprites[index];
+    if (IsSheetCell(index)) {
+        const auto &r = sprite.rect;
+        if (r.x + r.w > loaded.rect.w || r.y + r.h > loaded.rect.h) {
+            // Sheet got smaller since it was sliced
+            return false;
+        }
+    } else {
+        sprite.rect = loaded.rect;
+    }
+    sprite.image = std::move(loaded.image);
+    return true;
+}
+
+void Atlas::ExpandSources() {
+    for (size_t i = 0; i < sprites.size(); ++i) {
+        if (!IsSheetCell(i))
+            sprites[i].source = -1;
+    }
+    for (auto &anim : animations) {
+        anim.source = -1;
+    }
+    for (auto &source : sources) {
+        if (source.type != Source_Sheet)
+            source.anim = -1;
+    }
+}
+
+bool Atlas::IsSheetCell(size_t index) const {
+    int source = sprites[index].source;
+    return source >= 0 && sources[source].type == Source_Sheet;
+}
+
+bool Atlas::ReadSpriteSize(size_t index) {
+    auto &sprite = sprites[index];
+    if (sprite.image != nullptr || IsSheetCell(index)) {
+        return true;
+    }
+    sprite.rect.x = 0;
+    sprite.rect.y = 0;
+    return ReadImageSize(sprite.filename, &sprite.rect.w, &sprite.rect.h);
+}
+
+bool Atlas::LoadSpriteToDraw(size_t index) {
+    auto size = sprites[index].rect;
+    return LoadSpriteImage(index) && sprites[index].rect.w == size.w
+        && sprites[index].rect.h == size.h;
+}
+
+bool Atlas::LoadSprites() {
+    auto pending = std::find_if(sprites.begin(), sprites.end(),
+        [](const Sprite &sprite) { return sprite.image == nullptr; });
+    if (pending == sprites.end()) {
+        return true;
+    }
+    return KeepSprites(&Atlas::LoadSpriteImage);
+}
+
+void Atlas::Open() {
+    if (opened) return;
+    opened = true;
+    SPACK_PROFILE("open");
+    Manifest cache;
+    if (ReadManifest(ManifestPath(*this), &cache) && RenderCached(cache)) {
+        return;
+    }
+    ReadSpriteSizes();
+    Invalidate(Stage_Pad);
+}
+
+bool Atlas::ReadSpriteSizes() {
+    return KeepSprites(&Atlas::ReadSpriteSize);
+}
+
+bool Atlas::KeepSprites(bool (Atlas::*fn)(size_t)) {
+    std::vector<SpriteHandle> failed;
+    for (size_t i = 0; i < sprites.size(); ++i) {
+        if (!(this->*fn)(i))
+            failed.push_back(sprites.HandleAt(i));
+    }
+    for (auto handle : failed) {
+        UnloadSprite(sprites.IndexOf(handle));
+        sprites.Remove(handle);
+        ++version;
+    }
+    if (failed.size() > 0) {
+        for (auto &anim : animations) {
+            anim.frames.erase(
+                std::remove_if(anim.frames.begin(), anim.frames.end(),
+                    [this](SpriteHandle frame) {
+                        return !sprites.Contains(frame);
+                    }),
+                anim.frames.end());
+        }
+    }
     RenderSprites();
-    Render();
-    if (render_sprites.size() == 0 || texture == nullptr) {
+    return failed.size() == 0;
+}
+
+bool Atlas::Build(bool force) {
+    SPACK_PROFILE("build");
+    Manifest cache;
+    if (force || !ReadManifest(ManifestPath(*this), &cache) ||
+        !RenderCached(cache)) {
+        if (stream_sprites) {
+            ReadSpriteSizes();
+        } else {
+            LoadSprites();
+        }
+        RenderSprites();
+        if (!Render()) return false;
+    } else if (dirty_stages != Stage_None && !Update()) {
         return false;
     }
+    return layout.size() > 0 && image.pixels.size() > 0;
+}
 
-    std::sort(render_sprites.begin(), render_sprites.end(),
-        [](const RenderSprite &a, const RenderSprite &b) {
-            return a.sorting_order < b.sorting_order;
-        });
-    std::vector<SDL_FRect> quads;
-    quads.reserve(render_sprites.size());
-
-    for (const auto &sprite : render_sprites) {
-        SDL_FRect quad{float(sprite.dst.x + padding),
-                       float(sprite.dst.y + padding),
-                       float(sprite.dst.w - padding * 2.0f),
-                       float(sprite.dst.h - padding * 2.0f)};
+bool Atlas::Encode(std::vector<unsigned char> *data) const {
+    SPACK_PROFILE("encode");
+    return EncodeImage(image, image_format, data);
+}
+
+bool Atlas::WriteOutputs(AtlasExporter fn,
+                         const std::vector<unsigned char> &data) {
+    // Quads are in export order, rows stay in packing order
+    auto order = ExportOrder();
+    std::vector<size_t> position(order.size());
+    for (size_t k = 0; k < order.size(); ++k) {
+        position[order[k]] = k;
+    }
+    std::vector<SDL_FRect> quads(layout.size());
+    for (size_t i = 0; i < layout.size(); ++i) {
+        SDL_FRect quad{float(layout.x[i] + padding),
+                       float(layout.y[i] + padding),
+                       float(layout.w[i] - padding * 2.0f),
+                       float(layout.h[i] - padding * 2.0f)};
         if (y_up) {
             quad.y = height - quad.y - quad.h;
         }
@@ -248,16 +804,50 @@ bool Atlas::Export(AtlasExporter fn) {
             quad.x /= width;
             quad.y /= height;
         }
-        quads.push_back(quad);
+        quads[position[layout.sprite[i]]] = quad;
+    }
+    bool ok;
+    {
+        SPACK_PROFILE("write metadata");
+        ok = fn(*this, quads);
+    }
+    {
+        SPACK_PROFILE("write image");
+        ok = WriteFile(OutputPath(output_image), data) && ok;
+    }
+    if (ok) {
+        SPACK_PROFILE("write manifest");
+        auto manifest = MakeManifest(*this);
+        manifest.layout.resize(layout.size());
+        for (size_t i = 0; i < layout.size(); ++i) {
+            manifest.layout[position[layout.sprite[i]]] = {layout.x[i],
+                                                           layout.y[i]};
+        }
+        WriteManifest(ManifestPath(*this), manifest);
+        exported_layout = manifest.layout_hash;
+    }
+    if (stream_sprites) {
+        image = Image{};
+        exported_layout = 0;
     }
-    bool ok = fn(*this, quads);
-    WriteTexture(device, output_image, image_format, texture);
     return ok;
 }
 
+bool Atlas::Export(AtlasExporter fn) {
+    std::vector<unsigned char> data;
+    return Build() && Encode(&data) && WriteOutputs(fn, data);
+}
+
 void Atlas::SetZoom(float value) {
     scale += value * 0.25f;
     scale = fminf(scale, 4.0f);
 }
 
+std::string Atlas::OutputPath(const std::string &filename) const {
+    if (working_dir == "" || std::filesystem::path(filename).is_absolute()) {
+        return filename;
+    }
+    return (std::filesystem::path(working_dir) / filename).u8string();
+}
+
 } // namespace spack
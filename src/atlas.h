@@ -21,25 +21,109 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <optional>
+#include <cstdint>
 
 #include "SDL.h"
 #include "image.h"
+#include "preview.h"
+#include "thumbnails.h"
 
 namespace spack {
 
 using AtlasExporter = bool (*)(const class Atlas &atlas,
                                const std::vector<SDL_FRect> &quads);
 
+struct Manifest;
+struct AtlasJob;
+class ThreadPool;
+
+// Packing statistics of the last time the atlas was rendered.
+struct AtlasStats {
+    int width = 0, height = 0;
+    int sprites = 0;
+    // Area covered by sprites without and with padding
+    int64_t sprite_area = 0;
+    int64_t padded_area = 0;
+    // Number of times Pack ran out of space and started over
+    int pack_retries = 0;
+    // Largest packing mask allocated while packing
+    size_t peak_mask_bytes = 0;
+    // Layout was reused from the last export instead of packed
+    bool cached_layout = false;
+};
+
+// Stages of rendering an atlas in the order they run, see Atlas::Update.
+// Sprites are decoded while compositing. Encoding the image and writing
+// the metadata only happen on export, so options that only change the
+// exported files do not invalidate any stage.
+enum AtlasStage : uint32_t {
+    Stage_None = 0,
+    // Sprite sizes including padding, see RenderSprites
+    Stage_Pad = 1 << 0,
+    Stage_Sort = 1 << 1,
+    Stage_Pack = 1 << 2,
+    Stage_Composite = 1 << 3,
+    Stage_All = Stage_Pad | Stage_Sort | Stage_Pack | Stage_Composite,
+};
+
+// Outcome of the last export of an atlas, set by ExportQueue.
+enum ExportStatus {
+    Export_None,
+    // Skipped since the outputs were up to date with the manifest
+    Export_UpToDate,
+    Export_Written,
+    Export_Failed,
+};
+
+// Sprite decoded on a worker thread before it is added to an atlas, see
+// Atlas::ImportSprite.
+struct SpriteImport {
+    std::string filename;
+    int anim = 0;
+    std::optional<Sprite> sprite;
+    std::atomic<bool> done{false};
+};
+
+// Image of a sprite already in an atlas decoded on a worker, see
+// Atlas::StreamSprite.
+struct SpriteLoad {
+    SpriteHandle handle;
+    std::string filename;
+    std::optional<Sprite> sprite;
+    std::atomic<bool> done{false};
+};
+
 class Atlas {
 public:
-    int width, height;
-    std::vector<Sprite> sprites;
+    int width = 0, height = 0;
+    // Animations refer to sprites by handle, dense indices change when
+    // sprites are removed. Exported in animation order, see ExportOrder.
+    SlotMap<Sprite> sprites;
     std::vector<Animation> animations;
-    SDL_Texture *texture = nullptr;
+    // Saved instead of the sprites and animations that came from them
+    std::vector<SpriteSource> sources;
+
+    // Sprites being decoded in the order they were imported, and the
+    // number of imports since the queue was last empty
+    std::deque<std::shared_ptr<SpriteImport>> imports;
+    int import_batch = 0;
+
+    // Rendered atlas
+    Image image;
+    AtlasStats stats;
+    ExportStatus export_status = Export_None;
 
     std::string output_file = "untitled.atlas";
     std::string output_image = "untitled.png";
 
+    // Directory relative output paths are written to, the current
+    // directory if empty. Does not change the paths in exported files.
+    std::string working_dir;
+
     ImageFormat image_format = Image_PNG;
     size_t exporter = 0;
 
@@ -68,6 +152,12 @@ public:
     // default is (0, 0) at the top left.
     bool y_up = false;
 
+    // Export packs using the sprite sizes read from the image headers,
+    // then decodes each sprite in pack order and releases it once drawn.
+    // The atlas image is released after it is written. Keeps memory use
+    // low for projects that do not fit in memory, see -max-memory.
+    bool stream_sprites = false;
+
     Atlas(SDL_Renderer *device) : device(device) {}
     ~Atlas();
 
@@ -77,21 +167,188 @@ public:
     bool AppendSprite(const std::string &filename, int anim = 0);
     void AppendSprite(const Sprite &sprite, int anim = 0);
 
+    // Adds a sprite without loading it, see LoadSprites.
+    void AppendSpriteFile(const std::string &filename, int anim = 0);
+
+    // Decodes a sprite on the workers and appends it once FinishImports
+    // finds it decoded. Sprites are appended in the order they were
+    // imported, so dropping many files keeps their order without
+    // decoding them on the UI thread.
+    void ImportSprite(ThreadPool *workers, const std::string &filename,
+                      int anim = 0);
+
+    // Appends the imported sprites that are decoded, stopping at the
+    // first one that is not. Returns the files that failed to decode.
+    std::vector<std::string> FinishImports();
+
+    // Decodes a sprite that is not loaded on the workers, so the editor
+    // can show an atlas opened from its cache before its sprites are
+    // decoded. Does nothing if the sprite is loaded or already queued.
+    void StreamSprite(ThreadPool *workers, size_t index);
+    // Keeps the sprite images StreamSprite finished decoding. Sprites
+    // that failed to decode are not queued again.
+    void FinishSpriteLoads();
+    bool IsStreaming() const;
+    // Removes a frame of an animation and its sprite from the atlas.
+    // Removing sprites leaves the rest of the layout valid, so the sprite
+    // is cleared from the atlas image instead of packing the atlas again.
+    void RemoveSprite(size_t anim, size_t frame);
+
+    // Removes an animation and its sprites.
+    void RemoveAnimation(size_t index);
+
+    // Forgets which directory lines sprites and animations came from, so
+    // they are saved one sprite per line. Called when they are edited by
+    // hand since the directory lines would not keep the edit. Sheet cells
+    // have no file of their own and are still saved as their sheet.
+    void ExpandSources();
+
+    // Loads all sprites that were added with AppendSpriteFile. Sprites
+    // that fail to load are removed from the atlas.
+    bool LoadSprites();
+    // Releases the image of a sprite, it is decoded again the next time
+    // it is drawn. Used when its file changed.
+    void UnloadSprite(size_t index);
+    // Shows the atlas in the editor the first time it is selected. Uses
+    // the layout and image of the last export if they are up to date, so
+    // no sprites are decoded until they are drawn or previewed. Otherwise
+    // only the sprite sizes are read and UpdateInBackground packs the
+    // atlas. Does nothing after the first call.
+    void Open();
+
+    // Reads the size of sprites that are not loaded without decoding
+    // them. Sprites that fail to read are removed from the atlas.
+    bool ReadSpriteSizes();
+
+    // Dense indices of the sprites in the order they are exported, which
+    // is the frames of each animation in order. Dense indices depend on
+    // the order sprites were removed in, the export order only on the
+    // animations, so exported files and manifests use it.
+    std::vector<uint32_t> ExportOrder() const;
+
     void SortRenderSprites();
     void RenderSprites();
 
-    SDL_Point PackedSize(int heur = 0, int n = 0) const;
-    SDL_Point Pack(int heur = 0, int n = 0);
+    // Packs the sprites in sorted order and returns the atlas size, see
+    // PackRects.
+    SDL_Point Pack();
+
+    // Marks a stage and every stage after it to run on the next Update,
+    // such as Stage_Composite when only the padding mode changed.
+    // Packing again also sorts if sprites were removed since the last
+    // sort.
+    void Invalidate(AtlasStage stage);
+
+    // Runs the stages that are out of date. Returns false if a sprite
+    // could not be drawn.
+    bool Update();
+
+    // Runs Update on a copy of the atlas on the worker so the editor does
+    // not block while packing. The atlas keeps its previous image until
+    // the copy is done, then takes its layout and image. Editing the atlas
+    // in the meantime cancels the copy and starts over. Waits for imports
+    // so a batch of imported sprites is packed once. Called every frame
+    // from the thread that owns the renderer.
+    void UpdateInBackground(ThreadPool *worker);
+    void CancelUpdate();
+    bool IsUpdating() const { return job != nullptr; }
+
+    // Fraction of the sprites drawn by the background update, 0 while it
+    // is still packing.
+    float UpdateProgress() const;
+
+    // Checks that the rendered sprites are inside the atlas, keep their
+    // padding and do not overlap. Checked after packing in debug builds.
+    bool ValidateLayout(std::string *error = nullptr) const;
 
     void CreateTexture(int w, int h);
-    void Render();
 
+    // Packs and composites the sprites, loading sprites that are not
+    // loaded. Returns false if one of them could not be drawn.
+    bool Render();
+
+    // Renders the atlas using the layout from the last export if the
+    // sprite sizes and packing options did not change. Only sprites that
+    // changed since the last export are loaded and drawn over the previous
+    // image. If the exported image cannot be used every sprite is drawn
+    // by the next Update instead. Returns false if the atlas needs to be
+    // packed again.
+    bool RenderCached(const Manifest &cache);
+
+    // Export is split into stages so exporting several atlases can overlap
+    // encoding one atlas with writing another. Build renders the atlas
+    // loading sprites as needed, Encode compresses the image and
+    // WriteOutputs writes the atlas file, the image and the manifest.
+    // None of the stages use the renderer. If force is true Build ignores
+    // the manifest and renders every sprite from its source file.
+    bool Build(bool force = false);
+    bool Encode(std::vector<unsigned char> *data) const;
+    bool WriteOutputs(AtlasExporter fn, const std::vector<unsigned char> &data);
     bool Export(AtlasExporter fn);
+
+    // Textures used by the UI, uploaded from the images on first use after
+    // they change. Must be called from the thread that owns the renderer.
+    // Tiled preview of the atlas image, see AtlasPreview.
+    AtlasPreview *Preview();
+    // Thumbnail of a sprite for the sprite list, see ThumbnailAtlas.
+    SDL_Texture *SpriteThumbnail(size_t index, SDL_FRect *uv);
+
     void SetZoom(float value);
 
+    // Path an output file is written to, see working_dir.
+    std::string OutputPath(const std::string &filename) const;
+
 private:
     SDL_Renderer *device;
-    std::vector<RenderSprite> render_sprites;
+    RenderLayout layout;
+
+    std::unique_ptr<AtlasPreview> preview;
+    bool texture_dirty = true;
+    std::unique_ptr<ThumbnailAtlas> thumbnails;
+    std::vector<std::shared_ptr<SpriteLoad>> sprite_loads;
+    bool opened = false;
+
+    // Layout hash of the last export if the image has not been changed
+    // since, lets RenderCached skip loading the exported image.
+    uint64_t exported_layout = 0;
+
+    // AtlasStage flags of the stages that need to run again
+    uint32_t dirty_stages = Stage_All;
+    // False once removing a sprite moved a row, see Invalidate
+    bool rows_sorted = true;
+    // Clears a stage after it ran and marks the stages after it
+    void FinishStage(AtlasStage stage);
+
+    // Incremented on every edit that changes what is rendered, a
+    // background update is only used if the atlas was not edited since
+    // it started.
+    uint64_t version = 0;
+    std::shared_ptr<AtlasJob> job;
+    // Set on copies rendered in the background
+    const std::atomic<bool> *cancel = nullptr;
+    std::atomic<int> *drawn = nullptr;
+
+    bool Cancelled() const;
+    std::unique_ptr<Atlas> Snapshot() const;
+    void TakeUpdate(Atlas *done);
+
+    // Sheet cells keep their rect when the sheet is loaded again
+    bool IsSheetCell(size_t index) const;
+    // Removes the sprite without removing it from its animation
+    void EraseSprite(SpriteHandle handle);
+    bool LoadSpriteImage(size_t index);
+    // Gives a sprite the image of a decoded copy of its file, fails if a
+    // sheet cell no longer fits in its sheet.
+    bool SetSpriteImage(size_t index, Sprite &&loaded);
+    bool ReadSpriteSize(size_t index);
+    // Loads a sprite for drawing at its current size, fails if the file
+    // changed size since.
+    bool LoadSpriteToDraw(size_t index);
+    // Removes the sprites fn fails for
+    bool KeepSprites(bool (Atlas::*fn)(size_t));
+    bool Composite(int w, int h);
+    void MarkTextureDirty();
+    void UpdateStats(bool cached_layout);
 };
 
 } // namespace spack
@@ -0,0 +1,130 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "cache.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "image.h"
+#include "io.h"
+#include "manifest.h"
+
+namespace spack {
+
+static std::atomic<ImageCache *> image_cache{nullptr};
+
+void SetImageCache(ImageCache *cache) {
+    image_cache = cache;
+}
+
+ImageCache *GetImageCache() {
+    return image_cache;
+}
+
+std::shared_ptr<const Image> ImageCache::Load(const std::string &filename) {
+    auto key = NormalizePath(filename);
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    if (!StatFile(key, &size, &mtime)) {
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // The entry is looked up again after waiting since it may have been
+    // evicted in the meantime
+    loaded.wait(lock, [this, &key] {
+        auto it = entries.find(key);
+        return it == entries.end() || !it->second.loading;
+    });
+    auto *entry = &entries[key];
+
+    if (entry->image != nullptr && entry->size == size
+            && entry->mtime == mtime) {
+        ++hits;
+        lru.splice(lru.begin(), lru, entry->lru);
+        return entry->image;
+    }
+    ++misses;
+    if (entry->image != nullptr) {
+        // Loading entries are not in lru so they cannot be evicted
+        bytes -= entry->image->pixels.size();
+        lru.erase(entry->lru);
+        entry->image = nullptr;
+    }
+    entry->loading = true;
+    lock.unlock();
+
+    // Decode without holding the lock so other images can be loaded
+    auto image = std::make_shared<Image>();
+    bool ok = LoadImage(key, image.get());
+
+    lock.lock();
+    entry->loading = false;
+    entry->image = ok ? std::move(image) : nullptr;
+    entry->size = size;
+    entry->mtime = mtime;
+    auto result = entry->image;
+    if (result != nullptr) {
+        bytes += result->pixels.size();
+        entry->lru = lru.insert(lru.begin(), key);
+        Evict();
+    }
+    lock.unlock();
+    loaded.notify_all();
+    return result;
+}
+
+void ImageCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    lru.clear();
+    bytes = 0;
+}
+
+void ImageCache::SetBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    Evict();
+}
+
+void ImageCache::Evict() {
+    // Keeps the image that was just loaded even if it is over budget
+    while (budget > 0 && bytes > budget && lru.size() > 1) {
+        auto it = entries.find(lru.back());
+        bytes -= it->second.image->pixels.size();
+        entries.erase(it);
+        lru.pop_back();
+    }
+}
+
+ImageCacheStats ImageCache::Stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ImageCacheStats stats;
+    stats.images = lru.size();
+    stats.bytes = bytes;
+    stats.hits = hits;
+    stats.misses = misses;
+    return stats;
+}
+
+} // namespace spack
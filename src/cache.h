@@ -0,0 +1,89 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_CACHE_H
+#define SPACK_CACHE_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "image.h"
+
+namespace spack {
+
+struct ImageCacheStats {
+    size_t images = 0;
+    // Size of the decoded pixels
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// Decoded images shared between all atlases and projects, so an image
+// used in several places is only decoded once. Images are decoded again
+// if the file changed since it was decoded. Safe to use from any thread.
+class ImageCache {
+public:
+    // Returns nullptr if the image could not be loaded.
+    std::shared_ptr<const Image> Load(const std::string &filename);
+
+    // Must not be called while images are being loaded.
+    void Clear();
+
+    // Drops the least recently used images once the decoded images take
+    // more than bytes, 0 for no limit. Dropped images stay in memory
+    // until the sprites using them release them.
+    void SetBudget(size_t bytes);
+
+    ImageCacheStats Stats();
+
+private:
+    struct Entry {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        std::shared_ptr<const Image> image;
+        // Another thread is decoding the image
+        bool loading = false;
+        // Position in lru if the entry has an image
+        std::list<std::string>::iterator lru;
+    };
+    std::unordered_map<std::string, Entry> entries;
+    // Entries with an image, most recently used first
+    std::list<std::string> lru;
+    size_t bytes = 0;
+    size_t budget = 0;
+    std::mutex mutex;
+    std::condition_variable loaded;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    void Evict();
+};
+
+// Sets the cache used by LoadSprite, images are not cached if nullptr.
+void SetImageCache(ImageCache *cache);
+ImageCache *GetImageCache();
+
+} // namespace spack
+
+#endif // SPACK_CACHE_H
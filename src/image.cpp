@@ -21,8 +21,16 @@
 #include <cassert>
 #include <vector>
 #include <string>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
 
 #include "SDL.h"
+#include "cache.h"
+#include "intern.h"
+#include "profile.h"
 #include "lodepng/lodepng.h"
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
@@ -31,7 +39,7 @@ namespace spack {
 
 const char *ImageExt[] {"png", "tga", "bmp"};
 
-static std::string BaseSpriteName(const std::string &filename) {
+std::string BaseSpriteName(const std::string &filename) {
     std::string result = filename;
     auto sep = result.find_last_of("/\\");
     if (sep != std::string::npos) {
@@ -44,134 +52,259 @@ static std::string BaseSpriteName(const std::string &filename) {
     return result;
 }
 
-std::optional<Sprite> LoadSprite(SDL_Renderer *device,
-                                 const std::string &filename) {
+bool LoadImage(const std::string &filename, Image *image) {
+    SPACK_PROFILE("decode");
     int w, h, comp;
-    auto *im = stbi_load(filename.c_str(), &w, &h, &comp, STBI_default);
-    if (im == nullptr) return {};
-
-    int fmt;
-    switch (comp) {
-    case 3:
-        fmt = SDL_PIXELFORMAT_RGB24;
-        break;
-    case 4:
-        fmt = SDL_PIXELFORMAT_RGBA32;
-        break;
+    auto *im = stbi_load(filename.c_str(), &w, &h, &comp, STBI_rgb_alpha);
+    if (im == nullptr) return false;
+
+    if (comp != 3 && comp != 4) {
+        stbi_image_free(im);
+        return false;
+    }
+    image->width = w;
+    image->height = h;
+    image->pixels.assign(im, im + size_t(w) * h * 4);
+    stbi_image_free(im);
+    return true;
+}
+
+bool ReadImageSize(const std::string &filename, int *w, int *h) {
+    int comp;
+    return stbi_info(filename.c_str(), w, h, &comp) != 0;
+}
+
+static void AppendData(void *context, void *data, int size) {
+    auto *out = static_cast<std::vector<unsigned char> *>(context);
+    auto *bytes = static_cast<const unsigned char *>(data);
+    out->insert(out->end(), bytes, bytes + size);
+}
+
+bool EncodeImage(const Image &image, ImageFormat image_fmt,
+                 std::vector<unsigned char> *data) {
+    const auto *pixels = (const void *)image.pixels.data();
+    int w = image.width;
+    int h = image.height;
+    data->clear();
+
+    switch (image_fmt) {
+    case Image_PNG: {
+        unsigned char *png = nullptr;
+        size_t size = 0;
+        if (lodepng_encode32(&png, &size, image.pixels.data(), w, h) != 0) {
+            free(png);
+            return false;
+        }
+        data->assign(png, png + size);
+        free(png);
+        return true;
+    }
+    case Image_TGA:
+        return stbi_write_tga_to_func(&AppendData, data, w, h, 4, pixels) != 0;
+    case Image_BMP:
+        return stbi_write_bmp_to_func(&AppendData, data, w, h, 4, pixels) != 0;
     default:
-        return {};
+        assert(false && "Invalid image format");
     }
+    return false;
+}
+
+bool WriteFile(const std::string &filename,
+               const std::vector<unsigned char> &data) {
+    auto *file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) return false;
+
+    size_t n = fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+    return n == data.size();
+}
+
+bool WriteImage(const std::string &filename, ImageFormat image_fmt,
+                const Image &image) {
+    std::vector<unsigned char> data;
+    return EncodeImage(image, image_fmt, &data) && WriteFile(filename, data);
+}
+
+void ClearImage(Image *image, int w, int h) {
+    image->width = w;
+    image->height = h;
+    image->pixels.assign(size_t(w) * h * 4, 0);
+}
+
+bool IsLossless(ImageFormat image_fmt) {
+    // BMP is written without an alpha channel
+    return image_fmt == Image_PNG || image_fmt == Image_TGA;
+}
+
+std::optional<Sprite> LoadSprite(const std::string &filename) {
+    std::shared_ptr<const Image> image;
+    if (auto *cache = GetImageCache()) {
+        image = cache->Load(filename);
+    } else {
+        auto decoded = std::make_shared<Image>();
+        if (LoadImage(filename, decoded.get()))
+            image = std::move(decoded);
+    }
+    if (image == nullptr) return {};
 
     Sprite sprite;
     sprite.filename = filename;
-    sprite.short_name = BaseSpriteName(filename);
-    sprite.rect = SDL_Rect{0, 0, w, h};
-    sprite.texture = SDL_CreateTexture(device, fmt,
-                                       SDL_TEXTUREACCESS_STATIC, w, h);
-
-    int pitch = comp * w;
-    SDL_UpdateTexture(sprite.texture, &sprite.rect, (const void *)im, pitch);
-    SDL_SetTextureBlendMode(sprite.texture, SDL_BLENDMODE_BLEND);
+    sprite.short_name = InternString(BaseSpriteName(filename));
+    sprite.rect = SDL_Rect{0, 0, image->width, image->height};
+    sprite.image = std::move(image);
+    return sprite;
+}
 
-    stbi_image_free(im);
+Sprite MakeSpriteRef(const std::string &filename) {
+    Sprite sprite;
+    sprite.filename = filename;
+    sprite.short_name = InternString(BaseSpriteName(filename));
+    sprite.rect = SDL_Rect{0, 0, 0, 0};
     return sprite;
 }
 
-void WriteTexture(SDL_Renderer *device, const std::string &filename,
-                  ImageFormat image_fmt, SDL_Texture *tex) {
-    uint32_t fmt;
-    int access;
-    int w, h;
+static bool IsTransparent(const Image &image, const SDL_Rect &rect) {
+    for (int y = rect.y; y < rect.y + rect.h; ++y) {
+        const auto *row = &image.pixels[(rect.x + y * image.width) * 4];
+        for (int x = 0; x < rect.w; ++x) {
+            if (row[x * 4 + 3] != 0) return false;
+        }
+    }
+    return true;
+}
+
+std::vector<Sprite> SliceSheet(const Sprite &sheet, const SpriteSource &src) {
+    std::vector<Sprite> cells;
+    if (sheet.image == nullptr || src.cell_w <= 0 || src.cell_h <= 0) {
+        return cells;
+    }
+    const auto &image = *sheet.image;
+    int step_x = src.cell_w + src.spacing;
+    int step_y = src.cell_h + src.spacing;
+    int cols = (image.width - src.margin * 2 + src.spacing) / step_x;
+    int rows = (image.height - src.margin * 2 + src.spacing) / step_y;
 
-    SDL_QueryTexture(tex, &fmt, &access, &w, &h);
-    assert(access == SDL_TEXTUREACCESS_TARGET);
-    assert(fmt == SDL_PIXELFORMAT_RGBA32);
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            SDL_Rect rect{src.margin + col * step_x, src.margin + row * step_y,
+                          src.cell_w, src.cell_h};
+            if (IsTransparent(image, rect)) continue;
 
-    int pitch = 4 * w;
-    auto image = new unsigned char[pitch * h];
+            Sprite cell = sheet;
+            cell.short_name = InternString(std::string(sheet.short_name)
+                + "_" + std::to_string(row * cols + col));
+            cell.rect = rect;
+            cells.push_back(std::move(cell));
+        }
+    }
+    return cells;
+}
 
-    SDL_SetRenderTarget(device, tex);
-    SDL_RenderReadPixels(device, nullptr, fmt, (void *)image, pitch);
-    SDL_SetRenderTarget(device, nullptr);
+void UpdateTexture(SDL_Texture *tex, const Image &image) {
+    SDL_UpdateTexture(tex, nullptr, (const void *)image.pixels.data(),
+                      image.width * 4);
+}
 
-    switch (image_fmt) {
-    case Image_PNG:
-        lodepng_encode32_file(filename.c_str(), image, w, h);
-        break;
-    case Image_TGA:
-        stbi_write_tga(filename.c_str(), w, h, 4, (const void *)image);
-        break;
-    case Image_BMP:
-        stbi_write_bmp(filename.c_str(), w, h, 4, (const void *)image);
-        break;
-    default:
-        assert(false && "Invalid image format");
+void RenderLayout::clear() {
+    for (auto *col : {&w, &h, &x, &y, &sprite, &group}) col->clear();
+    row.clear();
+}
+
+void RenderLayout::reserve(size_t n) {
+    for (auto *col : {&w, &h, &x, &y, &sprite, &group}) col->reserve(n);
+}
+
+void RenderLayout::Append(int sprite_index, int padded_w, int padded_h) {
+    w.push_back(padded_w);
+    h.push_back(padded_h);
+    x.push_back(0);
+    y.push_back(0);
+    sprite.push_back(sprite_index);
+    group.push_back(0);
+    if (row.size() <= size_t(sprite_index)) {
+        row.resize(sprite_index + 1, -1);
+    }
+    row[sprite_index] = int(sprite.size() - 1);
+}
+
+void RenderLayout::SwapErase(size_t i) {
+    size_t last = size() - 1;
+    row[sprite[i]] = -1;
+    if (i != last) {
+        row[sprite[last]] = int(i);
+    }
+    for (auto *col : {&w, &h, &x, &y, &sprite, &group}) {
+        (*col)[i] = col->back();
+        col->pop_back();
     }
-    delete[] image;
 }
 
-RenderSprite MakeRenderSprite(SDL_Renderer *device, const Sprite &sprite,
-                              int padding, PaddingMode mode) {
+void RenderLayout::MoveSprite(size_t from, size_t to) {
+    int moved = RowOf(from);
+    if (to < row.size()) {
+        row[to] = moved;
+    }
+    if (moved >= 0) {
+        sprite[moved] = int(to);
+    }
+    if (from < row.size()) {
+        row.resize(from);
+    }
+}
+
+void RenderLayout::Permute(const std::vector<uint32_t> &order) {
+    assert(order.size() == size());
+    std::vector<int> tmp(order.size());
+    for (auto *col : {&w, &h, &x, &y, &sprite, &group}) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            tmp[i] = (*col)[order[i]];
+        }
+        col->swap(tmp);
+    }
+    for (size_t i = 0; i < sprite.size(); ++i) {
+        row[sprite[i]] = int(i);
+    }
+}
+
+static void FillPixels(unsigned char *dst, int n, const unsigned char *color) {
+    for (int i = 0; i < n; ++i) {
+        memcpy(dst + i * 4, color, 4);
+    }
+}
+
+void DrawSprite(Image *target, const Sprite &sprite, int x, int y,
+                int padding, PaddingMode mode) {
+    assert(sprite.image != nullptr);
+    const unsigned char Alpha[4] = {0, 0, 0, 0};
+    const unsigned char Debug[4] = {255, 255, 0, 255};
+
+    const auto &src = *sprite.image;
     int p = padding;
-    RenderSprite result;
-    result.src = {0, 0, sprite.rect.w + 2*p, sprite.rect.h + 2*p};
-    result.texture = SDL_CreateTexture(device, SDL_PIXELFORMAT_RGBA32,
-                                       SDL_TEXTUREACCESS_TARGET,
-                                       result.src.w, result.src.h);
-    SDL_SetTextureBlendMode(result.texture, SDL_BLENDMODE_BLEND);
-
-    SDL_Rect bleed_src[8] = {
-        // Corners
-        {0, 0, 1, 1},
-        {sprite.rect.w - 1, 0, 1, 1},
-        {sprite.rect.w - 1, sprite.rect.h - 1, 1, 1},
-        {0, sprite.rect.h - 1, 1, 1},
-        // Edges
-        {0, 0, sprite.rect.w, 1},
-        {sprite.rect.w - 1, 0, 1, sprite.rect.h},
-        {0, sprite.rect.h - 1, sprite.rect.w, 1},
-        {0, 0, 1, sprite.rect.h}
-    };
-
-    SDL_Rect bleed_dst[8] = {
-        // Corners
-        {0, 0, p, p},
-        {sprite.rect.w + p, 0, p, p},
-        {sprite.rect.w + p, sprite.rect.h + p, p, p},
-        {0, sprite.rect.h + p, p, p},
-        // Edges
-        {p, 0, sprite.rect.w, p},
-        {sprite.rect.w + p, p, p, sprite.rect.h},
-        {p, sprite.rect.h + p, sprite.rect.w, p},
-        {0, p, p, sprite.rect.h}
-    };
-
-    // Main dst
-    SDL_Rect dst{p, p, sprite.rect.w, sprite.rect.h};
-    SDL_SetRenderTarget(device, result.texture);
-    SDL_SetRenderDrawColor(device, 0, 0, 0, 0);
-    SDL_RenderClear(device);
-
-    for (int i = 0; i < 8; ++i) {
-        switch (mode) {
-        case Padding_Bleed:
-            SDL_RenderCopy(device, sprite.texture,
-                           &bleed_src[i], &bleed_dst[i]);
-            break;
-        case Padding_Alpha:
-            SDL_RenderFillRect(device, &bleed_dst[i]);
-            break;
-        case Padding_Debug:
-            SDL_SetRenderDrawColor(device, 255, 255, 0, 255);
-            SDL_RenderFillRect(device, &bleed_dst[i]);
-            break;
-        default:
-            assert(false && "Invalid padding mode");
+    int w = sprite.rect.w;
+    int h = sprite.rect.h;
+    assert(x >= 0 && x + w + 2*p <= target->width);
+    assert(y >= 0 && y + h + 2*p <= target->height);
+
+    for (int dy = 0; dy < h + 2*p; ++dy) {
+        // Bleed padding repeats the nearest edge pixel
+        int sy = std::clamp(dy - p, 0, h - 1) + sprite.rect.y;
+        const auto *src_row = &src.pixels[(sprite.rect.x + sy * src.width) * 4];
+        auto *dst_row = &target->pixels[(x + (y + dy) * target->width) * 4];
+        const unsigned char *left = src_row;
+        const unsigned char *right = src_row + (w - 1) * 4;
+
+        bool edge = dy < p || dy >= h + p;
+        if (mode != Padding_Bleed) {
+            left = right = mode == Padding_Alpha ? Alpha : Debug;
         }
+        if (edge && mode != Padding_Bleed) {
+            FillPixels(dst_row + p * 4, w, left);
+        } else {
+            memcpy(dst_row + p * 4, src_row, w * 4);
+        }
+        FillPixels(dst_row, p, left);
+        FillPixels(dst_row + (w + p) * 4, p, right);
     }
-    SDL_RenderCopy(device, sprite.texture, &sprite.rect, &dst);
-    SDL_SetRenderTarget(device, nullptr);
-    return result;
 }
 
 } // namespace spack
@@ -21,31 +21,98 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <optional>
+#include <cstdint>
 
 #include "SDL.h"
+#include "slotmap.h"
 
 namespace spack {
 
+// Decoded image in RGBA32 format
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
 struct Sprite {
     std::string filename;
-    std::string short_name;
+    // Interned, see InternString
+    const char *short_name = "";
+    // Region of the image containing the sprite. The size is known even
+    // when the image is not loaded.
     SDL_Rect rect;
-    SDL_Texture *texture;
+    std::shared_ptr<const Image> image;
+    // Index in Atlas::sources if added by a sprite_dir or sheet line
+    int source = -1;
 };
 
+using SpriteHandle = SlotHandle;
+
 struct Animation {
     std::string name;
-    std::vector<int> frames;
+    std::vector<SpriteHandle> frames;
     float frame_time = 0.016f;
+    // Index in Atlas::sources if created by an anim_dir line
+    int source = -1;
+};
+
+enum SourceType {
+    Source_SpriteDir,
+    Source_AnimDir,
+    Source_Sheet,
+};
+
+// Line of the project file that added several sprites or animations at
+// once: the files matching a pattern, one animation per directory or the
+// cells of a sprite sheet.
+struct SpriteSource {
+    SourceType type = Source_SpriteDir;
+    // Absolute pattern, such as /path/walk/*.png, or sheet file
+    std::string pattern;
+    // Sheet cell size, spacing in between cells and margin around them
+    int cell_w = 0, cell_h = 0;
+    int spacing = 0, margin = 0;
+    // Animation the line was in, a source without sprites is saved there.
+    // -1 once the source is no longer saved, see Atlas::ExpandSources.
+    int anim = 0;
 };
 
-struct RenderSprite {
-    SDL_Rect src;
-    SDL_Rect dst;
-    SDL_Texture *texture;
-    int sorting_order;
-    int animation_group;
+// Packing state of the sprites stored as columns, so sorting and packing
+// only read the arrays they need instead of striding over whole structs.
+// Row i is the i-th sprite in packing order.
+struct RenderLayout {
+    // Size of the sprite including padding
+    std::vector<int> w, h;
+    // Position of the padded sprite in the atlas
+    std::vector<int> x, y;
+    // Dense index of the sprite in Atlas::sprites
+    std::vector<int> sprite;
+    // Index of the animation the sprite is in
+    std::vector<int> group;
+    // Row of each dense sprite index, -1 if the sprite has no row. Not a
+    // column, it is indexed by sprite.
+    std::vector<int> row;
+
+    size_t size() const { return sprite.size(); }
+    void clear();
+    void reserve(size_t n);
+    void Append(int sprite_index, int padded_w, int padded_h);
+    int RowOf(size_t sprite_index) const {
+        return sprite_index < row.size() ? row[sprite_index] : -1;
+    }
+    // Removes row i by moving the last row in its place, so the rows are
+    // no longer in packing order
+    void SwapErase(size_t i);
+    // Renumbers the sprite at dense index from, after the sprite at to was
+    // removed from the SlotMap and the last sprite took its place
+    void MoveSprite(size_t from, size_t to);
+    // Row i becomes the row that was at order[i]
+    void Permute(const std::vector<uint32_t> &order);
+
+    SDL_Rect Rect(size_t i) const { return SDL_Rect{x[i], y[i], w[i], h[i]}; }
 };
 
 enum PaddingMode {
@@ -62,22 +129,43 @@ enum ImageFormat {
 
 extern const char *ImageExt[];
 
-std::optional<Sprite> LoadSprite(SDL_Renderer *device,
-                                 const std::string &filename);
-
-void WriteTexture(SDL_Renderer *device, const std::string &filename,
-                  ImageFormat image_fmt, SDL_Texture *tex);
-
-RenderSprite MakeRenderSprite(SDL_Renderer *device, const Sprite &sprite,
-                              int padding, PaddingMode mode);
-
-template <typename T>
-void FreeSpriteTextures(const std::vector<T> &sprites) {
-    if (sprites.size() == 0) return;
-    for (const auto &sprite : sprites) {
-        SDL_DestroyTexture(sprite.texture);
-    }
-}
+bool LoadImage(const std::string &filename, Image *image);
+bool ReadImageSize(const std::string &filename, int *w, int *h);
+bool EncodeImage(const Image &image, ImageFormat image_fmt,
+                 std::vector<unsigned char> *data);
+bool WriteImage(const std::string &filename, ImageFormat image_fmt,
+                const Image &image);
+bool WriteFile(const std::string &filename,
+               const std::vector<unsigned char> &data);
+void ClearImage(Image *image, int w, int h);
+
+// Returns true if an image written in this format can be loaded back
+// without losing any information.
+bool IsLossless(ImageFormat image_fmt);
+
+// Name of a sprite file without its directory and extension
+std::string BaseSpriteName(const std::string &filename);
+
+// Loads a sprite without using the renderer so sprites can be loaded from
+// any thread. The image is shared with other sprites if an ImageCache is
+// set.
+std::optional<Sprite> LoadSprite(const std::string &filename);
+
+// Returns a sprite that only references the file, the sprite has no
+// image until it is loaded with LoadSprite.
+Sprite MakeSpriteRef(const std::string &filename);
+
+// Splits a sheet into a sprite for each cell that is not fully
+// transparent. The sprites share the sheet image and are named after the
+// sheet and the cell index in row order.
+std::vector<Sprite> SliceSheet(const Sprite &sheet, const SpriteSource &src);
+
+void UpdateTexture(SDL_Texture *tex, const Image &image);
+
+// Copies the sprite and its padding to the target image with the top left
+// corner of the padding at (x, y).
+void DrawSprite(Image *target, const Sprite &sprite, int x, int y,
+                int padding, PaddingMode mode);
 
 } // namespace spack
 
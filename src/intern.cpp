@@ -0,0 +1,77 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "intern.h"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace spack {
+
+namespace {
+
+struct StringPool {
+    static constexpr size_t block_size = 64 * 1024;
+
+    std::mutex mutex;
+    std::unordered_set<std::string_view> strings;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    // Block strings are currently copied to
+    char *block = nullptr;
+    size_t used = block_size;
+
+    char *Allocate(size_t n) {
+        if (n > block_size / 4) {
+            // Large strings get a block of their own so the rest of the
+            // current block is not wasted
+            blocks.emplace_back(new char[n]);
+            return blocks.back().get();
+        }
+        if (used + n > block_size) {
+            blocks.emplace_back(new char[block_size]);
+            block = blocks.back().get();
+            used = 0;
+        }
+        auto *result = block + used;
+        used += n;
+        return result;
+    }
+};
+
+} // namespace
+
+const char *InternString(const std::string &str) {
+    // Never destroyed so names stay valid during static destruction
+    static auto *pool = new StringPool;
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    auto it = pool->strings.find(std::string_view(str));
+    if (it != pool->strings.end()) {
+        return it->data();
+    }
+    auto *copy = pool->Allocate(str.size() + 1);
+    memcpy(copy, str.c_str(), str.size() + 1);
+    pool->strings.insert(std::string_view(copy, str.size()));
+    return copy;
+}
+
+} // namespace spack
@@ -20,12 +20,20 @@
 
 #include <memory>
 #include <filesystem>
+#include <system_error>
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
 #include <cassert>
 #include <sstream>
+#include <algorithm>
+#include <mutex>
+#include <cctype>
 
 #include "SDL.h"
 #include "atlas.h"
+#include "jobs.h"
+#include "profile.h"
 
 namespace spack {
 
@@ -52,6 +60,13 @@ std::string BasePath(const std::string &filename) {
     return "./";
 }
 
+std::string NormalizePath(const std::string &filename) {
+    std::error_code ec;
+    auto path = std::filesystem::absolute(filename, ec);
+    if (ec) return filename;
+    return path.lexically_normal().u8string();
+}
+
 static std::string RelativePathRelative(const std::string &base,
                                         const std::string &filename) {
     auto base_path = BasePath(base);
@@ -59,6 +74,273 @@ static std::string RelativePathRelative(const std::string &base,
     return rel;
 }
 
+bool NaturalLess(const std::string &a, const std::string &b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (!isdigit((unsigned char)a[i]) || !isdigit((unsigned char)b[j])) {
+            if (a[i] != b[j]) return a[i] < b[j];
+            ++i, ++j;
+            continue;
+        }
+        // Compare numbers by value, a longer number without its leading
+        // zeros is larger.
+        while (i < a.size() && a[i] == '0') ++i;
+        while (j < b.size() && b[j] == '0') ++j;
+        size_t n = i, m = j;
+        while (n < a.size() && isdigit((unsigned char)a[n])) ++n;
+        while (m < b.size() && isdigit((unsigned char)b[m])) ++m;
+        if (n - i != m - j) return n - i < m - j;
+        int cmp = a.compare(i, n - i, b, j, m - j);
+        if (cmp != 0) return cmp < 0;
+        i = n, j = m;
+    }
+    if (a.size() - i != b.size() - j) return a.size() - i < b.size() - j;
+    // Equal apart from leading zeros
+    return a < b;
+}
+
+bool MatchGlob(const char *pattern, const char *name) {
+    const char *star = nullptr, *retry = nullptr;
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            star = pattern++;
+            retry = name;
+        } else if (*pattern == '?' || *pattern == *name) {
+            ++pattern, ++name;
+        } else if (star != nullptr) {
+            // Let the last * match one more character
+            pattern = star + 1;
+            name = ++retry;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') ++pattern;
+    return *pattern == '\0';
+}
+
+namespace {
+
+struct ScannedFile {
+    // Directory relative to the pattern directory, "" for the directory
+    // itself
+    std::string dir;
+    std::string path;
+};
+
+// Sprites of a sprite_dir, anim_dir or sheet line. Every directory is
+// listed by a separate job so large trees are listed in parallel, sheets
+// are decoded and sliced by a single job.
+struct SourceScan {
+    SpriteSource source;
+    std::vector<Sprite> cells;
+
+    std::string glob;
+    std::filesystem::path root;
+    int min_depth = 0;
+    // Unlimited if negative
+    int max_depth = 0;
+
+    std::mutex mutex;
+    std::vector<ScannedFile> files;
+    bool ok = true;
+    // Why the scan failed, without the line number
+    std::string error;
+};
+
+} // namespace
+
+static void ScanDir(ThreadPool *pool, SourceScan *scan,
+                    const std::filesystem::path &dir, int depth) {
+    SPACK_PROFILE("scan");
+    std::vector<ScannedFile> files;
+    std::vector<std::filesystem::path> subdirs;
+    std::error_code ec;
+    std::filesystem::directory_iterator it(dir, ec), end;
+
+    for (; !ec && it != end; it.increment(ec)) {
+        // Symlinks to directories are not followed to avoid cycles
+        auto status = it->symlink_status(ec);
+        if (ec) break;
+        if (std::filesystem::is_directory(status)) {
+            if (scan->max_depth < 0 || depth < scan->max_depth)
+                subdirs.push_back(it->path());
+            continue;
+        }
+        auto name = it->path().filename().u8string();
+        if (depth < scan->min_depth || !MatchGlob(scan->glob.c_str(),
+                                                  name.c_str())) {
+            continue;
+        }
+        if (!it->is_regular_file(ec)) {
+            // Such as a broken symlink
+            ec.clear();
+            continue;
+        }
+        auto rel = dir.lexically_relative(scan->root).generic_u8string();
+        files.push_back(ScannedFile{rel == "." ? "" : rel,
+                                    it->path().u8string()});
+    }
+    for (auto &subdir : subdirs) {
+        pool->Run([pool, scan, subdir, depth] {
+            ScanDir(pool, scan, subdir, depth + 1);
+        });
+    }
+    std::lock_guard<std::mutex> lock(scan->mutex);
+    if (ec && scan->ok) {
+        scan->ok = false;
+        scan->error = "Failed to list " + dir.u8string() + ": "
+                    + ec.message();
+    }
+    scan->files.insert(scan->files.end(), files.begin(), files.end());
+}
+
+// Starts listing the files matching pattern. Only the file name may have
+// wildcards, except for a ** directory right before it which matches any
+// number of directories, for example sprites/**/*.png.
+static void StartDirScan(ThreadPool *pool, SourceScan *scan) {
+    const auto &pattern = scan->source.pattern;
+    auto sep = pattern.find_last_of("/\\");
+    auto dir = sep != std::string::npos ? pattern.substr(0, sep) : ".";
+    scan->glob = pattern.substr(sep + 1);
+
+    bool recursive = HasExtension(dir, "**")
+        && (dir.size() == 2 || dir[dir.size() - 3] == '/'
+            || dir[dir.size() - 3] == '\\');
+    if (recursive) {
+        dir = dir.size() == 2 ? "." : dir.substr(0, dir.size() - 3);
+        if (dir == "") dir = "/";
+    }
+    if (dir.find_first_of("*?") != std::string::npos) {
+        scan->ok = false;
+        scan->error = "Wildcards are only supported in the file name and "
+                      "as a ** directory before it: "
+                    + NormalizePath(pattern);
+        return;
+    }
+    // Animations are made from the files in subdirectories
+    scan->min_depth = scan->source.type == Source_AnimDir ? 1 : 0;
+    scan->max_depth = recursive ? -1 : scan->min_depth;
+    scan->root = std::filesystem::path(dir).lexically_normal();
+    pool->Run([pool, scan] { ScanDir(pool, scan, scan->root, 0); });
+}
+
+// Parses "path cell_w cell_h [spacing margin]", the path may have spaces.
+static bool ParseSheet(const std::string &value, const std::string &base,
+                       SpriteSource *source) {
+    std::vector<int> args;
+    auto end = value.size();
+    while (args.size() < 4) {
+        auto sep = end > 0 ? value.find_last_of(' ', end - 1)
+                           : std::string::npos;
+        if (sep == std::string::npos) break;
+        auto arg = value.substr(sep + 1, end - sep - 1);
+        if (arg == "" || arg.find_first_not_of("0123456789")
+                != std::string::npos) {
+            break;
+        }
+        args.insert(args.begin(), std::stoi(arg));
+        end = sep;
+    }
+    if (args.size() == 3) {
+        // First number is part of the path
+        end = value.find(' ', end + 1);
+        args.erase(args.begin());
+    }
+    if (args.size() < 2 || args[0] <= 0 || args[1] <= 0) {
+        return false;
+    }
+    source->type = Source_Sheet;
+    source->pattern = base + value.substr(0, end);
+    source->cell_w = args[0];
+    source->cell_h = args[1];
+    if (args.size() == 4) {
+        source->spacing = args[2];
+        source->margin = args[3];
+    }
+    return true;
+}
+
+static void StartSheetScan(ThreadPool *pool, SourceScan *scan) {
+    pool->Run([scan] {
+        SPACK_PROFILE("slice");
+        // Decoded once, every cell references the same image
+        auto sheet = LoadSprite(scan->source.pattern);
+        if (!sheet.has_value()) {
+            scan->ok = false;
+            scan->error = "Failed to load sheet "
+                        + NormalizePath(scan->source.pattern);
+            return;
+        }
+        scan->cells = SliceSheet(sheet.value(), scan->source);
+    });
+}
+
+// Starts finding the sprites of a sprite_dir, anim_dir or sheet line. The
+// scan fails without starting if the line is invalid.
+static std::unique_ptr<SourceScan> StartSourceScan(ThreadPool *pool,
+                                                   const std::string &key,
+                                                   const std::string &value,
+                                                   const std::string &base) {
+    auto scan = std::make_unique<SourceScan>();
+    if (key == "sheet") {
+        if (!ParseSheet(value, base, &scan->source)) {
+            scan->ok = false;
+            scan->error = "Expected sheet path cell_w cell_h "
+                          "[spacing margin]";
+            return scan;
+        }
+        StartSheetScan(pool, scan.get());
+        return scan;
+    }
+    scan->source.type = key == "anim_dir" ? Source_AnimDir : Source_SpriteDir;
+    scan->source.pattern = base + value;
+    StartDirScan(pool, scan.get());
+    return scan;
+}
+
+static bool IsSourceKey(const std::string &key) {
+    return key == "sprite_dir" || key == "anim_dir" || key == "sheet";
+}
+
+static void SortScannedFiles(std::vector<ScannedFile> *files) {
+    std::sort(files->begin(), files->end(),
+        [](const ScannedFile &a, const ScannedFile &b) {
+            if (a.dir != b.dir) return NaturalLess(a.dir, b.dir);
+            return NaturalLess(a.path, b.path);
+        });
+}
+
+static bool SplitLine(const std::string &line,
+                      std::string *key, std::string *value) {
+    auto sep = line.find(' ');
+    if (sep == std::string::npos) {
+        return false;
+    }
+    *key = line.substr(0, sep);
+    *value = line.substr(sep + 1);
+    return true;
+}
+
+// The first animation is the default group of sprites that are not part
+// of an animation, which is not exported as an animation. Added before
+// lines that need an animation if the project does not start with it.
+static int AddDefaultGroup(Atlas *atlas) {
+    if (atlas->animations.size() == 0) {
+        Animation none{};
+        none.name = "<none>";
+        atlas->animations.push_back(std::move(none));
+    }
+    return 0;
+}
+
+static bool ParseError(std::string *error, int line, const std::string &msg) {
+    if (error != nullptr) {
+        *error = "line " + std::to_string(line) + ": " + msg;
+    }
+    return false;
+}
+
 template <typename T>
 static void ParseInt(T *opt, const std::string &expect,
                      const std::string &key, const std::string &value) {
@@ -69,9 +351,14 @@ static void ParseInt(T *opt, const std::string &expect,
 
 bool LoadProject(SDL_Renderer *device,
                  const std::string &filename,
-                 std::vector<std::unique_ptr<Atlas>> *project) {
+                 std::vector<std::unique_ptr<Atlas>> *project,
+                 bool load_sprites,
+                 std::string *error) {
     auto *file = fopen(filename.c_str(), "r");
-    if (file == nullptr) return false;
+    if (file == nullptr) {
+        if (error != nullptr) *error = strerror(errno);
+        return false;
+    }
 
     fseek(file, 0, SEEK_END);
     auto size = ftell(file);
@@ -81,37 +368,77 @@ bool LoadProject(SDL_Renderer *device,
     fread((void *)buffer, sizeof(char), size, file);
 
     std::string data(buffer, size);
-    std::stringstream lines(data);
-    std::string line;
+    delete[] buffer;
+    fclose(file);
 
     auto base = std::filesystem::absolute(BasePath(filename)).u8string();
+    if (!ParseProject(device, data, base, project, error)) {
+        return false;
+    }
+    if (!load_sprites) {
+        return true;
+    }
+    for (auto &atlas : *project) {
+        // Render all atlases on load
+        atlas->LoadSprites();
+        atlas->Render();
+    }
+    return true;
+}
+
+bool ParseProject(SDL_Renderer *device,
+                  const std::string &data,
+                  const std::string &base,
+                  std::vector<std::unique_ptr<Atlas>> *project,
+                  std::string *error) {
+    SPACK_PROFILE("parse");
+    std::stringstream lines(data);
+    std::string line, key, value;
+    int line_number = 0;
     int selected_anim = -1;
+    // First animation the next frame_time line applies to
+    size_t timed_anim = 0;
 
     assert(project != nullptr);
     project->clear();
 
+    // Directories are listed and sheets sliced in parallel before
+    // parsing, in the order of their lines.
+    std::unique_ptr<ThreadPool> scan_pool;
+    std::vector<std::unique_ptr<SourceScan>> scans;
     while (std::getline(lines, line)) {
+        if (!SplitLine(line, &key, &value) || !IsSourceKey(key)) continue;
+        if (scan_pool == nullptr)
+            scan_pool = std::make_unique<ThreadPool>(0, "scan");
+        scans.push_back(StartSourceScan(scan_pool.get(), key, value, base));
+    }
+    if (scan_pool != nullptr) {
+        scan_pool->Wait();
+    }
+    size_t next_scan = 0;
+    lines.clear();
+    lines.seekg(0);
+
+    while (std::getline(lines, line)) {
+        ++line_number;
         if (line == "" || line == "\n" || line == "\r\n") continue;
         if (line[0] == '#') continue;
 
-        auto sep = line.find(' ');
-        if (sep == std::string::npos) {
+        if (!SplitLine(line, &key, &value)) {
             break;
         }
-        auto key = line.substr(0, sep);
-        auto value = line.substr(sep + 1);
 
         if (key == "atlas") {
             project->push_back(std::make_unique<Atlas>(device));
             project->back()->output_file = value;
             selected_anim = -1;
+            timed_anim = 0;
             continue;
         }
 
         if (project->size() == 0) {
-            fclose(file);
-            delete[] buffer;
-            return false;
+            return ParseError(error, line_number,
+                              "Expected an atlas line before " + key);
         }
         auto &atlas = *project->back();
 
@@ -121,22 +448,65 @@ bool LoadProject(SDL_Renderer *device,
         }
 
         if (key == "anim") {
+            if (value != "<none>") {
+                AddDefaultGroup(&atlas);
+            }
             Animation anim{};
             anim.name = value;
             atlas.animations.push_back(anim);
-            selected_anim++;
+            selected_anim = atlas.animations.size() - 1;
+            timed_anim = selected_anim;
         }
 
         if (key == "frame_time") {
             assert(atlas.animations.size() > 0);
-            atlas.animations.back().frame_time = std::stof(value);
+            for (size_t i = timed_anim; i < atlas.animations.size(); ++i)
+                atlas.animations[i].frame_time = std::stof(value);
+        }
+
+        if (IsSourceKey(key)) {
+            auto &scan = *scans[next_scan++];
+            if (!scan.ok) {
+                return ParseError(error, line_number, scan.error);
+            }
+            int source = atlas.sources.size();
+            if (selected_anim < 0) {
+                selected_anim = AddDefaultGroup(&atlas);
+            }
+            scan.source.anim = selected_anim;
+            atlas.sources.push_back(scan.source);
+            for (auto &cell : scan.cells) {
+                cell.source = source;
+                atlas.AppendSprite(cell, selected_anim);
+            }
+            SortScannedFiles(&scan.files);
+
+            // Animations of an anim_dir are saved as its line, so sprite
+            // lines after it still go to the animation before it
+            int dir_anim = selected_anim;
+            for (size_t i = 0; i < scan.files.size(); ++i) {
+                const auto &file = scan.files[i];
+                if (key == "anim_dir"
+                        && (i == 0 || file.dir != scan.files[i - 1].dir)) {
+                    // One animation per directory, named after it
+                    Animation anim{};
+                    anim.name = file.dir;
+                    anim.source = source;
+                    atlas.animations.push_back(anim);
+                    if (i == 0) timed_anim = atlas.animations.size() - 1;
+                    dir_anim = atlas.animations.size() - 1;
+                }
+                atlas.AppendSpriteFile(file.path, dir_anim);
+                atlas.sprites.back().source = source;
+            }
+            continue;
         }
 
         if (key == "sprite") {
             if (selected_anim < 0) {
-                selected_anim = 0;
+                selected_anim = AddDefaultGroup(&atlas);
             }
-            atlas.AppendSprite(base + value, selected_anim);
+            atlas.AppendSpriteFile(base + value, selected_anim);
             continue;
         }
 
@@ -147,12 +517,6 @@ bool LoadProject(SDL_Renderer *device,
         ParseInt(&atlas.square_texture, "square", key, value);
         ParseInt(&atlas.image_format, "image_format", key, value);
     }
-    delete[] buffer;
-    fclose(file);
-    for (auto &atlas : *project) {
-        // Render all atlases on load
-        atlas->Render();
-    }
     return true;
 }
 
@@ -171,16 +535,54 @@ bool SaveProject(const std::string &filename,
         fprintf(file, "normalize %d\n", atlas->normalize);
         fprintf(file, "y_up %d\n", atlas->y_up);
 
-        for (const auto &anim : atlas->animations) {
+        // Sprites and animations from a directory are saved as the line
+        // they came from, at the position of the first one. Lines that
+        // matched nothing are saved in the animation they were in.
+        std::vector<bool> saved(atlas->sources.size());
+        std::vector<bool> used(atlas->sources.size());
+        for (const auto &sprite : atlas->sprites) {
+            if (sprite.source >= 0) used[sprite.source] = true;
+        }
+        auto save_source = [&](int source) {
+            const auto &src = atlas->sources[source];
+            if (!saved[source]) {
+                auto path = RelativePathRelative(filename, src.pattern);
+                if (src.type == Source_Sheet) {
+                    fprintf(file, "sheet %s %d %d %d %d\n", path.c_str(),
+                            src.cell_w, src.cell_h, src.spacing, src.margin);
+                } else {
+                    fprintf(file, "%s %s\n", src.type == Source_AnimDir
+                            ? "anim_dir" : "sprite_dir", path.c_str());
+                }
+                saved[source] = true;
+                return true;
+            }
+            return false;
+        };
+
+        for (size_t i = 0; i < atlas->animations.size(); ++i) {
+            const auto &anim = atlas->animations[i];
+            if (anim.source >= 0) {
+                if (save_source(anim.source))
+                    fprintf(file, "frame_time %f\n", anim.frame_time);
+                continue;
+            }
             fprintf(file, "anim %s\n", anim.name.c_str());
             fprintf(file, "frame_time %f\n", anim.frame_time);
 
-            for (int frame : anim.frames) {
-                auto &sprite = atlas->sprites[frame];
-
+            for (auto frame : anim.frames) {
+                auto &sprite = atlas->sprites.Get(frame);
+                if (sprite.source >= 0) {
+                    save_source(sprite.source);
+                    continue;
+                }
                 fprintf(file, "sprite %s\n",
                         RelativePathRelative(filename, sprite.filename).c_str());
             }
+            for (size_t j = 0; j < atlas->sources.size(); ++j) {
+                if (!used[j] && atlas->sources[j].anim == int(i))
+                    save_source(int(j));
+            }
         }
     }
     fclose(file);
@@ -188,16 +590,19 @@ bool SaveProject(const std::string &filename,
 }
 
 bool ExportAtlasFile(const Atlas &atlas, const std::vector<SDL_FRect> &quads) {
-    auto *file = fopen(atlas.output_file.c_str(), "w+");
+    auto *file = fopen(atlas.OutputPath(atlas.output_file).c_str(), "w+");
     if (file == nullptr) return false;
 
     fprintf(file, "i %s %d\n", atlas.output_image.c_str(), int(atlas.sprites.size()));
 
+    // Quads are in export order, so the frames of the animations follow
+    // each other and are numbered by counting them
+    auto order = atlas.ExportOrder();
     for (size_t i = 0; i < quads.size(); ++i) {
-        auto &sprite = atlas.sprites[i];
+        auto &sprite = atlas.sprites[order[i]];
         auto &quad = quads[i];
 
-        fprintf(file, "s %s", sprite.short_name.c_str());
+        fprintf(file, "s %s", sprite.short_name);
         if (atlas.normalize) {
            fprintf(file, " %f %f %f %f\n", quad.x, quad.y, quad.w, quad.h);
            continue;
@@ -213,11 +618,13 @@ bool ExportAtlasFile(const Atlas &atlas, const std::vector<SDL_FRect> &quads) {
                 anim.name.c_str(), int(anim.frames.size()), anim.frame_time);
     }
 
+    int next_sprite = int(atlas.animations[0].frames.size());
     for (size_t i = 1; i < atlas.animations.size(); ++i) {
         const auto &anim = atlas.animations[i];
         // Associate a sprite with an animation frame
         for (size_t j = 0; j < anim.frames.size(); ++j) {
-            fprintf(file, "f %s %d %d\n", anim.name.c_str(), int(j), anim.frames[j]);
+            fprintf(file, "f %s %d %d\n", anim.name.c_str(), int(j),
+                    next_sprite++);
         }
     }
     fclose(file);
@@ -225,23 +632,26 @@ bool ExportAtlasFile(const Atlas &atlas, const std::vector<SDL_FRect> &quads) {
 }
 
 bool ExportJson(const Atlas &atlas, const std::vector<SDL_FRect> &quads) {
-    auto *file = fopen(atlas.output_file.c_str(), "w+");
+    auto *file = fopen(atlas.OutputPath(atlas.output_file).c_str(), "w+");
     if (file == nullptr) return false;
 
     fprintf(file, "{\"texture\":\"%s\",", atlas.output_image.c_str());
     fprintf(file, "\"sprites\":[");
 
+    // See ExportAtlasFile
+    auto order = atlas.ExportOrder();
     for (size_t i = 0; i < quads.size(); ++i) {
-        auto &sprite = atlas.sprites[i];
+        auto &sprite = atlas.sprites[order[i]];
         auto &quad = quads[i];
 
         if (i > 0) fprintf(file, ",");
-        fprintf(file, "{\"name\":\"%s\",", sprite.short_name.c_str());
+        fprintf(file, "{\"name\":\"%s\",", sprite.short_name);
         fprintf(file, "\"x\":%f,\"y\":%f,\"w\":%f,\"h\":%f}",
                 quad.x, quad.y, quad.w, quad.h);
     }
     fprintf(file, "],\"animations\":{");
 
+    int next_sprite = int(atlas.animations[0].frames.size());
     for (size_t i = 1; i < atlas.animations.size(); ++i) {
         const auto &anim = atlas.animations[i];
         if (i > 1) fprintf(file, ",");
@@ -249,7 +659,7 @@ bool ExportJson(const Atlas &atlas, const std::vector<SDL_FRect> &quads) {
 
         for (size_t j = 0; j < anim.frames.size(); ++j) {
             if (j > 0) fprintf(file, ",");
-            fprintf(file, "%d", anim.frames[j]);
+            fprintf(file, "%d", next_sprite++);
         }
         fprintf(file, "]");
     }
@@ -30,9 +30,35 @@ std::string RenameWithExt(const std::string &filename, const std::string &ext);
 bool HasExtension(const std::string &filename, const std::string &ext);
 std::string BasePath(const std::string &filename);
 
+// Orders numbers in strings by value, so frame2 comes before frame10.
+bool NaturalLess(const std::string &a, const std::string &b);
+
+// Matches a file name against a pattern with * and ? wildcards.
+bool MatchGlob(const char *pattern, const char *name);
+
+// Absolute path without redundant separators, "." and ".." components,
+// used to compare paths.
+std::string NormalizePath(const std::string &filename);
+
+// Sprites are only loaded and atlases rendered if load_sprites is true,
+// otherwise Atlas::LoadSprites needs to be called before using the atlas.
+// If loading fails error is set to the reason, see ParseProject.
 bool LoadProject(SDL_Renderer *device,
                  const std::string &filename,
-                 std::vector<std::unique_ptr<Atlas>> *project);
+                 std::vector<std::unique_ptr<Atlas>> *project,
+                 bool load_sprites = true,
+                 std::string *error = nullptr);
+
+// Parses a project from memory without loading sprites, sprite paths are
+// relative to base which must end with a path separator. Directories of
+// sprite_dir and anim_dir lines are listed when parsing, a line whose
+// directory cannot be listed or sheet cannot be loaded fails the parse.
+// If parsing fails error is set to the line number and the reason.
+bool ParseProject(SDL_Renderer *device,
+                  const std::string &data,
+                  const std::string &base,
+                  std::vector<std::unique_ptr<Atlas>> *project,
+                  std::string *error = nullptr);
 
 bool SaveProject(const std::string &filename,
                  const std::vector<std::unique_ptr<Atlas>> &atlases);
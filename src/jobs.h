@@ -0,0 +1,67 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_JOBS_H
+#define SPACK_JOBS_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace spack {
+
+// Fixed size pool of worker threads running jobs in the order they were
+// added.
+class ThreadPool {
+public:
+    // Uses one thread per core if threads is 0. The threads are named in
+    // profiles, the name must be a string literal.
+    explicit ThreadPool(int threads = 0, const char *name = "worker");
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void Run(std::function<void()> job);
+
+    // Blocks until all jobs added so far are done.
+    void Wait();
+
+    int Size() const;
+
+private:
+    const char *name;
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_done;
+    size_t pending = 0;
+    bool stop = false;
+
+    void Work();
+};
+
+int DefaultThreadCount();
+
+} // namespace spack
+
+#endif // SPACK_JOBS_H
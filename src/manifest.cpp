@@ -0,0 +1,312 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "manifest.h"
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <system_error>
+#include <sstream>
+#include <cstdio>
+#include <cinttypes>
+
+#include "atlas.h"
+#include "pack.h"
+
+namespace spack {
+
+// Bump when the manifest format or anything that affects the exported
+// output changes, so old manifests are not trusted.
+constexpr int ManifestVersion = 5;
+constexpr uint64_t HashPrime = 1099511628211ull;
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t h) {
+    auto *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= HashPrime;
+    }
+    return h;
+}
+
+uint64_t HashString(const std::string &str, uint64_t h) {
+    // Include the size so ("ab", "c") and ("a", "bc") hash differently
+    uint64_t size = str.size();
+    h = HashBytes(&size, sizeof(size), h);
+    return HashBytes(str.data(), str.size(), h);
+}
+
+template <typename T>
+static uint64_t HashValue(const T &value, uint64_t h) {
+    return HashBytes(&value, sizeof(T), h);
+}
+
+bool HashFile(const std::string &filename, uint64_t *hash) {
+    auto *file = fopen(filename.c_str(), "rb");
+    if (file == nullptr) return false;
+
+    unsigned char buffer[64 * 1024];
+    uint64_t h = HashSeed;
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        h = HashBytes(buffer, n, h);
+    }
+    fclose(file);
+    *hash = h;
+    return true;
+}
+
+bool StatFile(const std::string &filename, uint64_t *size, int64_t *mtime) {
+    std::error_code ec;
+    auto file_size = std::filesystem::file_size(filename, ec);
+    if (ec) return false;
+    auto time = std::filesystem::last_write_time(filename, ec);
+    if (ec) return false;
+
+    *size = file_size;
+    *mtime = time.time_since_epoch().count();
+    return true;
+}
+
+std::string ManifestPath(const Atlas &atlas) {
+    return atlas.OutputPath(atlas.output_file) + ".manifest";
+}
+
+uint64_t HashAtlasOptions(const Atlas &atlas) {
+    uint64_t h = HashValue(ManifestVersion, HashSeed);
+    h = HashString(atlas.output_file, h);
+    h = HashString(atlas.output_image, h);
+    h = HashValue(atlas.image_format, h);
+    h = HashValue(atlas.exporter, h);
+    h = HashValue(atlas.padding, h);
+    h = HashValue(atlas.padding_mode, h);
+    h = HashValue(atlas.square_texture, h);
+    h = HashValue(atlas.normalize, h);
+    h = HashValue(atlas.y_up, h);
+
+    // Sprites are hashed in export order, which the frame counts are
+    // enough to split into animations
+    for (const auto &anim : atlas.animations) {
+        h = HashString(anim.name, h);
+        h = HashValue(anim.frame_time, h);
+        h = HashValue(anim.frames.size(), h);
+    }
+    for (auto i : atlas.ExportOrder()) {
+        const auto &sprite = atlas.sprites[i];
+        h = HashString(sprite.filename, h);
+        // Cells of a sheet move when its spacing or margin changes
+        h = HashValue(sprite.rect.x, h);
+        h = HashValue(sprite.rect.y, h);
+    }
+    return h;
+}
+
+uint64_t HashAtlasLayout(const Atlas &atlas) {
+    uint64_t h = HashValue(ManifestVersion, HashSeed);
+    h = HashValue(atlas.padding, h);
+    h = HashValue(atlas.square_texture, h);
+
+    for (const auto &anim : atlas.animations) {
+        h = HashValue(anim.frames.size(), h);
+    }
+    for (auto i : atlas.ExportOrder()) {
+        const auto &sprite = atlas.sprites[i];
+        // Position in the file, the exported pixels of a sheet cell are
+        // only reused if it was cut from the same place
+        h = HashValue(sprite.rect.x, h);
+        h = HashValue(sprite.rect.y, h);
+        h = HashValue(sprite.rect.w, h);
+        h = HashValue(sprite.rect.h, h);
+    }
+    return h;
+}
+
+bool ReadManifest(const std::string &filename, Manifest *manifest) {
+    auto *file = fopen(filename.c_str(), "r");
+    if (file == nullptr) return false;
+
+    fseek(file, 0, SEEK_END);
+    auto size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    std::string data(size, '\0');
+    size = fread(&data[0], sizeof(char), size, file);
+    data.resize(size);
+    fclose(file);
+
+    std::stringstream lines(data);
+    std::string line;
+    int version = 0;
+
+    while (std::getline(lines, line)) {
+        if (line == "" || line[0] == '#') continue;
+
+        int n = 0;
+        switch (line[0]) {
+        case 'v':
+            if (sscanf(line.c_str(), "v %d", &version) != 1) return false;
+            break;
+        case 'h':
+            if (sscanf(line.c_str(), "h %" SCNx64,
+                       &manifest->options_hash) != 1)
+                return false;
+            break;
+        case 'l': {
+            int mode, fmt;
+            if (sscanf(line.c_str(), "l %" SCNx64 " %d %d %d %d",
+                       &manifest->layout_hash, &manifest->width,
+                       &manifest->height, &mode, &fmt) != 5)
+                return false;
+            manifest->padding_mode = static_cast<PaddingMode>(mode);
+            manifest->image_format = static_cast<ImageFormat>(fmt);
+            break;
+        }
+        case 'r': {
+            SDL_Point pos;
+            if (sscanf(line.c_str(), "r %d %d", &pos.x, &pos.y) != 2)
+                return false;
+            manifest->layout.push_back(pos);
+            break;
+        }
+        case 'i': {
+            ManifestInput in;
+            if (sscanf(line.c_str(), "i %" SCNu64 " %" SCNd64 " %d %d %n",
+                       &in.size, &in.mtime, &in.width, &in.height, &n) != 4
+                    || n == 0)
+                return false;
+            in.filename = line.substr(n);
+            manifest->inputs.push_back(std::move(in));
+            break;
+        }
+        case 'o': {
+            ManifestOutput out;
+            if (sscanf(line.c_str(), "o %" SCNx64 " %n", &out.hash, &n) != 1
+                    || n == 0)
+                return false;
+            out.filename = line.substr(n);
+            manifest->outputs.push_back(std::move(out));
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return version == ManifestVersion;
+}
+
+bool WriteManifest(const std::string &filename, const Manifest &manifest) {
+    auto *file = fopen(filename.c_str(), "w+");
+    if (file == nullptr) return false;
+
+    fprintf(file, "# spritepacker build manifest, do not edit\n");
+    fprintf(file, "v %d\n", ManifestVersion);
+    fprintf(file, "h %016" PRIx64 "\n", manifest.options_hash);
+    fprintf(file, "l %016" PRIx64 " %d %d %d %d\n", manifest.layout_hash,
+            manifest.width, manifest.height, manifest.padding_mode,
+            manifest.image_format);
+
+    for (const auto &pos : manifest.layout) {
+        fprintf(file, "r %d %d\n", pos.x, pos.y);
+    }
+    for (const auto &in : manifest.inputs) {
+        fprintf(file, "i %" PRIu64 " %" PRId64 " %d %d %s\n",
+                in.size, in.mtime, in.width, in.height, in.filename.c_str());
+    }
+    for (const auto &out : manifest.outputs) {
+        fprintf(file, "o %016" PRIx64 " %s\n", out.hash, out.filename.c_str());
+    }
+    fclose(file);
+    return true;
+}
+
+Manifest MakeManifest(const Atlas &atlas) {
+    Manifest manifest;
+    manifest.options_hash = HashAtlasOptions(atlas);
+    manifest.layout_hash = HashAtlasLayout(atlas);
+    manifest.width = atlas.width;
+    manifest.height = atlas.height;
+    manifest.padding_mode = atlas.padding_mode;
+    manifest.image_format = atlas.image_format;
+    manifest.inputs.reserve(atlas.sprites.size());
+
+    for (auto i : atlas.ExportOrder()) {
+        const auto &sprite = atlas.sprites[i];
+        ManifestInput in{sprite.filename, 0, 0, sprite.rect.w, sprite.rect.h};
+        StatFile(sprite.filename, &in.size, &in.mtime);
+        manifest.inputs.push_back(std::move(in));
+    }
+    for (const auto *out : {&atlas.output_file, &atlas.output_image}) {
+        ManifestOutput result{atlas.OutputPath(*out), 0};
+        HashFile(result.filename, &result.hash);
+        manifest.outputs.push_back(std::move(result));
+    }
+    return manifest;
+}
+
+bool IsInputUnchanged(const ManifestInput &in, const std::string &filename) {
+    uint64_t size;
+    int64_t mtime;
+    return in.filename == filename
+        && StatFile(filename, &size, &mtime)
+        && size == in.size && mtime == in.mtime;
+}
+
+bool IsUpToDate(const Atlas &atlas) {
+    Manifest manifest;
+    if (!ReadManifest(ManifestPath(atlas), &manifest)) {
+        return false;
+    }
+    if (manifest.options_hash != HashAtlasOptions(atlas)
+            || manifest.inputs.size() != atlas.sprites.size()) {
+        return false;
+    }
+    auto order = atlas.ExportOrder();
+    for (size_t k = 0; k < manifest.inputs.size(); ++k) {
+        const auto &sprite = atlas.sprites[order[k]];
+        if (!IsInputUnchanged(manifest.inputs[k], sprite.filename)) {
+            return false;
+        }
+    }
+    for (const auto &out : manifest.outputs) {
+        uint64_t hash;
+        if (!HashFile(out.filename, &hash) || hash != out.hash) {
+            return false;
+        }
+    }
+    return manifest.outputs.size() > 0;
+}
+
+bool ValidateManifestLayout(const Manifest &manifest, int padding,
+                            std::string *error) {
+    if (manifest.layout.size() != manifest.inputs.size()) {
+        if (error != nullptr) *error = "Layout does not match the sprites";
+        return false;
+    }
+    std::vector<PackRect> rects(manifest.layout.size());
+    for (size_t i = 0; i < rects.size(); ++i) {
+        rects[i].w = manifest.inputs[i].width + padding * 2;
+        rects[i].h = manifest.inputs[i].height + padding * 2;
+        rects[i].x = manifest.layout[i].x;
+        rects[i].y = manifest.layout[i].y;
+    }
+    return ValidateLayout(rects, PackSize{manifest.width, manifest.height},
+                          error);
+}
+
+} // namespace spack
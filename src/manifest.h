@@ -0,0 +1,100 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_MANIFEST_H
+#define SPACK_MANIFEST_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "atlas.h"
+
+namespace spack {
+
+// Build manifest written next to the atlas file on export. It records
+// what the atlas was built from so `-export` can skip atlases that are
+// already up to date.
+struct ManifestInput {
+    std::string filename;
+    uint64_t size;
+    int64_t mtime;
+    int width;
+    int height;
+};
+
+struct ManifestOutput {
+    std::string filename;
+    uint64_t hash;
+};
+
+struct Manifest {
+    uint64_t options_hash = 0;
+
+    // Packed layout, reused when only the sprite pixels changed.
+    uint64_t layout_hash = 0;
+    int width = 0;
+    int height = 0;
+    PaddingMode padding_mode = Padding_Bleed;
+    ImageFormat image_format = Image_PNG;
+    // Position of each sprite (including padding) in sprite order
+    std::vector<SDL_Point> layout;
+
+    std::vector<ManifestInput> inputs;
+    std::vector<ManifestOutput> outputs;
+};
+
+constexpr uint64_t HashSeed = 14695981039346656037ull;
+
+// 64 bit FNV-1a
+uint64_t HashBytes(const void *data, size_t size, uint64_t h = HashSeed);
+uint64_t HashString(const std::string &str, uint64_t h = HashSeed);
+bool HashFile(const std::string &filename, uint64_t *hash);
+bool StatFile(const std::string &filename, uint64_t *size, int64_t *mtime);
+
+std::string ManifestPath(const Atlas &atlas);
+uint64_t HashAtlasOptions(const Atlas &atlas);
+
+// Hash of everything that affects where sprites are packed: sprite sizes,
+// animation groups and packing options. Also covers where sheet cells are
+// cut from, since RenderCached reuses the exported pixels when the layout
+// hash matches. Sprite sizes must be known.
+uint64_t HashAtlasLayout(const Atlas &atlas);
+
+bool ReadManifest(const std::string &filename, Manifest *manifest);
+bool WriteManifest(const std::string &filename, const Manifest &manifest);
+
+// Builds a manifest from the current state of the atlas, its sprite files
+// and its output files. Should be called after the atlas was exported,
+// the layout is left for the caller to fill in.
+Manifest MakeManifest(const Atlas &atlas);
+
+// Returns true if the sprite file is the same as the manifest input.
+bool IsInputUnchanged(const ManifestInput &in, const std::string &filename);
+
+// Returns true if the atlas options, sprite files and output files all
+// match what was recorded in the manifest by the last export.
+bool IsUpToDate(const Atlas &atlas);
+
+// Checks the layout recorded by the last export, see ValidateLayout.
+bool ValidateManifestLayout(const Manifest &manifest, int padding,
+                            std::string *error = nullptr);
+
+} // namespace spack
+
+#endif // SPACK_MANIFEST_H
@@ -0,0 +1,261 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "pack.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+#include "profile.h"
+
+namespace spack {
+
+PackOrderKey MakePackOrderKey(uint32_t group, int w, int h, uint32_t row) {
+    uint64_t area = std::min<uint64_t>(uint64_t(w) * uint64_t(h),
+                                       UINT32_MAX);
+    return PackOrderKey{uint64_t(group) << 32 | (UINT32_MAX - area), row};
+}
+
+void SortPackOrder(std::vector<PackOrderKey> *keys) {
+    constexpr int digits = sizeof(uint64_t);
+    size_t n = keys->size();
+    if (n == 0) return;
+
+    std::vector<uint32_t> counts(digits * 256);
+    for (const auto &k : *keys) {
+        for (int d = 0; d < digits; ++d) {
+            ++counts[d * 256 + ((k.key >> (d * 8)) & 0xff)];
+        }
+    }
+    std::vector<PackOrderKey> tmp(n);
+    for (int d = 0; d < digits; ++d) {
+        auto *count = &counts[d * 256];
+        if (count[((*keys)[0].key >> (d * 8)) & 0xff] == n) continue;
+
+        uint32_t offset = 0;
+        for (int i = 0; i < 256; ++i) {
+            uint32_t c = count[i];
+            count[i] = offset;
+            offset += c;
+        }
+        for (const auto &k : *keys) {
+            tmp[count[(k.key >> (d * 8)) & 0xff]++] = k;
+        }
+        keys->swap(tmp);
+    }
+}
+
+static uint32_t NextPow2(uint32_t value) {
+    --value;
+    value |= value >> 1;
+    value |= value >> 2;
+    value |= value >> 4;
+    value |= value >> 8;
+    value |= value >> 16;
+    return value + 1;
+}
+
+// Returns approximate power of 2 packing size
+// This size assumes sprites can be packed without any wasted space,
+// which may not be the case so heur is a heuristic value used to
+// adjust the height until all sprites fit.
+PackSize PackedSize(const std::vector<PackRect> &rects, bool square,
+                    int heur, int n) {
+    int64_t area = 0;
+    int max_w = 0;
+    int max_h = 0;
+
+    for (const auto &rect : rects) {
+        area += int64_t(rect.w) * rect.h;
+        max_w = std::max(max_w, rect.w);
+        max_h = std::max(max_h, rect.h);
+    }
+
+    int a = ceilf(sqrtf(area));
+    int w = NextPow2(std::max(a, max_w));
+    int h = NextPow2(std::max(std::max(a, heur), max_h));
+
+    if (square) {
+        return PackSize{h, h};
+    }
+
+    // Try to use half the width
+    if (n <= 1 && w == h && int64_t(w / 2) * h > area) {
+        w /= 2;
+    }
+
+    // Try to use half the height. This is used to correct a
+    // mistake that can be made by halving the width, where half the
+    // width causes more wasted space. We stop if n > 1 and assume
+    // this is not possible.
+    if (n <= 1 && w != h && int64_t(h / 2) * w > area) {
+        h /= 2;
+    }
+    return PackSize{w, h};
+}
+
+// Checking the corners first is enough to reject most positions, but a
+// smaller rect can sit inside or cross the candidate without touching a
+// corner.
+static bool IsFree(const unsigned char *m, int stride, const PackRect &rect,
+                   int ox, int oy) {
+    for (int y = oy; y < oy + rect.h; ++y) {
+        if (memchr(m + ox + size_t(y) * stride, 255, rect.w) != nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PackInto(std::vector<PackRect> *rects, PackSize size,
+              std::vector<unsigned char> *mask) {
+    mask->assign(size_t(size.w) * size.h, 0);
+    auto *m = mask->data();
+
+    for (auto &rect : *rects) {
+        int ox = 0;
+        int oy = 0;
+        bool packed = false;
+        for (oy = 0; ; ++oy) {
+            if (oy + rect.h > size.h) {
+                // Need more space
+                return false;
+            }
+            for (ox = 0; ox <= size.w - rect.w; ++ox) {
+                unsigned char c = 0;
+                // Rect collisions
+                c |= m[ox + size_t(oy) * size.w];
+                c |= m[ox + size_t(oy + rect.h - 1) * size.w];
+                c |= m[(ox + rect.w - 1) + size_t(oy) * size.w];
+                c |= m[(ox + rect.w - 1) + size_t(oy + rect.h - 1) * size.w];
+                if (c == 0 && IsFree(m, size.w, rect, ox, oy)) {
+                    packed = true;
+                    break;
+                }
+            }
+            if (packed) break;
+        }
+        for (int y = oy; y < oy + rect.h; ++y) {
+            for (int x = ox; x < ox + rect.w; ++x) {
+                m[x + size_t(y) * size.w] = 255;
+            }
+        }
+        rect.x = ox;
+        rect.y = oy;
+    }
+    return true;
+}
+
+PackSize PackRects(std::vector<PackRect> *rects, bool square,
+                   PackStats *stats) {
+    std::vector<unsigned char> mask;
+    PackStats result;
+    int heur = 0;
+
+    for (int n = 0; ; ++n) {
+        assert(n < 512);
+        SPACK_PROFILE("pack");
+        auto size = PackedSize(*rects, square, heur, n);
+        result.peak_mask_bytes = std::max(result.peak_mask_bytes,
+                                          size_t(size.w) * size.h);
+        if (PackInto(rects, size, &mask)) {
+            result.retries = n;
+            if (stats != nullptr) *stats = result;
+            return size;
+        }
+        heur = size.h + 1;
+    }
+}
+
+static bool LayoutError(std::string *error, const std::string &msg) {
+    if (error != nullptr) *error = msg;
+    return false;
+}
+
+static std::string RectString(const std::vector<PackRect> &rects, size_t i) {
+    const auto &r = rects[i];
+    return "rect " + std::to_string(i) + " (" + std::to_string(r.w) + "x"
+        + std::to_string(r.h) + " at " + std::to_string(r.x) + ", "
+        + std::to_string(r.y) + ")";
+}
+
+bool ValidateLayout(const std::vector<PackRect> &rects, PackSize size,
+                    std::string *error) {
+    struct Edge {
+        int64_t x;
+        bool open;
+        size_t index;
+    };
+    std::vector<Edge> edges;
+    edges.reserve(rects.size() * 2);
+
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const auto &r = rects[i];
+        if (r.w < 0 || r.h < 0 || r.x < 0 || r.y < 0
+                || int64_t(r.x) + r.w > size.w
+                || int64_t(r.y) + r.h > size.h) {
+            return LayoutError(error, RectString(rects, i)
+                + " is outside of the " + std::to_string(size.w) + "x"
+                + std::to_string(size.h) + " atlas");
+        }
+        if (r.w == 0 || r.h == 0) continue;
+        edges.push_back(Edge{r.x, true, i});
+        edges.push_back(Edge{int64_t(r.x) + r.w, false, i});
+    }
+    // Rects that end where another one starts do not overlap, so closing
+    // edges go first.
+    std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+        if (a.x != b.x) return a.x < b.x;
+        if (a.open != b.open) return !a.open;
+        return a.index < b.index;
+    });
+
+    // Rects crossing the sweep line by their top edge. These never
+    // overlap, otherwise we would have stopped, so a new rect can only
+    // overlap the rects right above and below it.
+    std::map<int, size_t> active;
+    for (const auto &edge : edges) {
+        const auto &r = rects[edge.index];
+        if (!edge.open) {
+            active.erase(r.y);
+            continue;
+        }
+        auto next = active.lower_bound(r.y);
+        if (next != active.end() && next->first < r.y + r.h) {
+            return LayoutError(error, RectString(rects, edge.index)
+                + " overlaps " + RectString(rects, next->second));
+        }
+        if (next != active.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + rects[prev->second].h > r.y) {
+                return LayoutError(error, RectString(rects, edge.index)
+                    + " overlaps " + RectString(rects, prev->second));
+            }
+        }
+        active.emplace(r.y, edge.index);
+    }
+    return true;
+}
+
+} // namespace spack
@@ -0,0 +1,86 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_PACK_H
+#define SPACK_PACK_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace spack {
+
+// Rectangle placed by the packer, w and h include padding.
+struct PackRect {
+    int w = 0, h = 0;
+    int x = 0, y = 0;
+};
+
+struct PackSize {
+    int w = 0, h = 0;
+};
+
+struct PackStats {
+    // Number of times the rects did not fit and packing started over
+    int retries = 0;
+    // Largest mask allocated while packing
+    size_t peak_mask_bytes = 0;
+};
+
+// Sort key of a rect in packing order. Rects of the same animation group
+// are kept together, in group order, with the larger rects first. The row
+// of the rect is carried along to move the rects once they are sorted.
+struct PackOrderKey {
+    uint64_t key = 0;
+    uint32_t row = 0;
+};
+
+PackOrderKey MakePackOrderKey(uint32_t group, int w, int h, uint32_t row);
+
+// Stable LSD radix sort of the keys, 8 bits per pass. Histograms for every
+// digit are counted in one pass over the keys, and digits that are the
+// same for every key are skipped, so small group indices and areas only
+// cost a few passes.
+void SortPackOrder(std::vector<PackOrderKey> *keys);
+
+// Atlas size tried on the n-th attempt, heur is the minimum height. The
+// size is a power of two large enough to fit the area of all rects.
+PackSize PackedSize(const std::vector<PackRect> &rects, bool square,
+                    int heur = 0, int n = 0);
+
+// Places each rect, in order, at the first free position scanning rows
+// from the top. Returns false if a rect does not fit in the size.
+bool PackInto(std::vector<PackRect> *rects, PackSize size,
+              std::vector<unsigned char> *mask);
+
+// Packs the rects in order, making the atlas taller until they all fit.
+// Does not use SDL so it can be benchmarked on its own.
+PackSize PackRects(std::vector<PackRect> *rects, bool square,
+                   PackStats *stats = nullptr);
+
+// Checks that every rect is inside the atlas and that no two rects
+// overlap, rects that only touch are fine. Sweeps over the rect edges so
+// it is O(n log n). Returns false and describes the first problem found
+// in error if it is not nullptr.
+bool ValidateLayout(const std::vector<PackRect> &rects, PackSize size,
+                    std::string *error = nullptr);
+
+} // namespace spack
+
+#endif // SPACK_PACK_H
@@ -0,0 +1,265 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "preview.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "SDL.h"
+#include "image.h"
+
+namespace spack {
+
+constexpr int BackdropCell = 16;
+
+static uint64_t TileKey(int level, int tx, int ty) {
+    return uint64_t(level) << 48 | uint64_t(uint32_t(ty)) << 24
+        | uint64_t(uint32_t(tx));
+}
+
+// Size of the image at a mip level
+static int LevelSize(int size, int level) {
+    return (size + (1 << level) - 1) >> level;
+}
+
+// Averages each 2x2 block of a w x h RGBA region into dst, blocks on the
+// right and bottom edges may be smaller. Colors are weighted by alpha so
+// transparent pixels don't darken the edges of sprites.
+static void Reduce(const unsigned char *src, size_t pitch, int w, int h,
+                   unsigned char *dst, size_t dst_pitch) {
+    for (int y = 0; y < (h + 1) / 2; ++y) {
+        int rows = std::min(2, h - y * 2);
+        for (int x = 0; x < (w + 1) / 2; ++x) {
+            int cols = std::min(2, w - x * 2);
+            uint32_t sum[4] = {0, 0, 0, 0};
+            for (int sy = 0; sy < rows; ++sy) {
+                const auto *px = &src[(y * 2 + sy) * pitch + x * 8];
+                for (int sx = 0; sx < cols; ++sx, px += 4) {
+                    sum[0] += uint32_t(px[0] * px[3]);
+                    sum[1] += uint32_t(px[1] * px[3]);
+                    sum[2] += uint32_t(px[2] * px[3]);
+                    sum[3] += px[3];
+                }
+            }
+            uint32_t n = uint32_t(rows * cols);
+            auto *out = &dst[y * dst_pitch + x * 4];
+            for (int c = 0; c < 3; ++c) {
+                out[c] = sum[3] > 0 ? (unsigned char)(sum[c] / sum[3]) : 0;
+            }
+            out[3] = (unsigned char)(sum[3] / n);
+        }
+    }
+}
+
+// Part of a mip level covered by a tile, empty past the edge of the level
+static SDL_Rect TileRect(const Image &image, int level, int tx, int ty) {
+    SDL_Rect rect{tx * AtlasPreview::TileSize, ty * AtlasPreview::TileSize,
+                  0, 0};
+    rect.w = std::min(AtlasPreview::TileSize,
+                      LevelSize(image.width, level) - rect.x);
+    rect.h = std::min(AtlasPreview::TileSize,
+                      LevelSize(image.height, level) - rect.y);
+    return rect;
+}
+
+AtlasPreview::~AtlasPreview() {
+    Invalidate();
+    if (backdrop != nullptr)
+        SDL_DestroyTexture(backdrop);
+}
+
+void AtlasPreview::Invalidate() {
+    for (auto &entry : tiles) {
+        SDL_DestroyTexture(entry.second.texture);
+    }
+    tiles.clear();
+}
+
+void AtlasPreview::DrawBackdrop(const SDL_Rect &dst) {
+    const uint8_t Colors[] = {0x80, 0xc0};
+    if (backdrop == nullptr) {
+        std::vector<unsigned char> pixels(size_t(TileSize) * TileSize * 4);
+        for (int y = 0; y < TileSize; ++y) {
+            for (int x = 0; x < TileSize; ++x) {
+                int cell = (x / BackdropCell + y / BackdropCell) & 1;
+                auto *px = &pixels[(size_t(y) * TileSize + x) * 4];
+                px[0] = px[1] = px[2] = Colors[cell];
+                px[3] = 255;
+            }
+        }
+        backdrop = SDL_CreateTexture(device, SDL_PIXELFORMAT_RGBA32,
+                                     SDL_TEXTUREACCESS_STATIC,
+                                     TileSize, TileSize);
+        if (backdrop == nullptr) return;
+        SDL_UpdateTexture(backdrop, nullptr, pixels.data(), TileSize * 4);
+    }
+
+    // The pattern repeats every tile since a tile is an even number of
+    // cells, only the tiles on screen are copied
+    int dw, dh;
+    SDL_GetRendererOutputSize(device, &dw, &dh);
+    int x_begin = std::max(0, -dst.x / TileSize);
+    int y_begin = std::max(0, -dst.y / TileSize);
+    for (int y = y_begin * TileSize; y < dst.h; y += TileSize) {
+        if (dst.y + y > dh) break;
+        for (int x = x_begin * TileSize; x < dst.w; x += TileSize) {
+            if (dst.x + x > dw) break;
+            SDL_Rect src{0, 0, std::min(TileSize, dst.w - x),
+                         std::min(TileSize, dst.h - y)};
+            SDL_Rect to{dst.x + x, dst.y + y, src.w, src.h};
+            SDL_RenderCopy(device, backdrop, &src, &to);
+        }
+    }
+}
+
+void AtlasPreview::BuildTile(const Image &image, int level, int tx, int ty,
+                             std::vector<unsigned char> *out) {
+    auto rect = TileRect(image, level, tx, ty);
+    out->assign(size_t(rect.w) * rect.h * 4, 0);
+
+    // The 2x2 tiles of the level below, tiles are an even size so each
+    // one reduces to a quarter of this tile
+    std::vector<unsigned char> built;
+    for (int cy = 0; cy < 2; ++cy) {
+        for (int cx = 0; cx < 2; ++cx) {
+            int ctx = tx * 2 + cx;
+            int cty = ty * 2 + cy;
+            auto child = TileRect(image, level - 1, ctx, cty);
+            if (child.w <= 0 || child.h <= 0) continue;
+
+            const unsigned char *src;
+            size_t pitch;
+            if (level == 1) {
+                src = &image.pixels[
+                    (size_t(child.y) * image.width + child.x) * 4];
+                pitch = size_t(image.width) * 4;
+            } else {
+                auto it = tiles.find(TileKey(level - 1, ctx, cty));
+                if (it != tiles.end() && it->second.pixels.size() > 0) {
+                    src = it->second.pixels.data();
+                } else {
+                    BuildTile(image, level - 1, ctx, cty, &built);
+                    src = built.data();
+                }
+                pitch = size_t(child.w) * 4;
+            }
+            size_t offset = (size_t(cy) * TileSize / 2 * rect.w
+                             + size_t(cx) * TileSize / 2) * 4;
+            Reduce(src, pitch, child.w, child.h, out->data() + offset,
+                   size_t(rect.w) * 4);
+        }
+    }
+}
+
+SDL_Texture *AtlasPreview::GetTile(const Image &image, int level,
+                                   int tx, int ty) {
+    auto &tile = tiles[TileKey(level, tx, ty)];
+    tile.last_used = frame;
+    if (tile.texture != nullptr) {
+        return tile.texture;
+    }
+    auto rect = TileRect(image, level, tx, ty);
+
+    const unsigned char *data;
+    int pitch;
+    if (level == 0) {
+        data = &image.pixels[(size_t(rect.y) * image.width + rect.x) * 4];
+        pitch = image.width * 4;
+    } else {
+        // Kept so the level above can be built from it
+        BuildTile(image, level, tx, ty, &tile.pixels);
+        data = tile.pixels.data();
+        pitch = rect.w * 4;
+    }
+    tile.texture = SDL_CreateTexture(device, SDL_PIXELFORMAT_RGBA32,
+                                     SDL_TEXTUREACCESS_STATIC,
+                                     rect.w, rect.h);
+    if (tile.texture != nullptr) {
+        SDL_SetTextureBlendMode(tile.texture, SDL_BLENDMODE_BLEND);
+        SDL_UpdateTexture(tile.texture, nullptr, data, pitch);
+    }
+    return tile.texture;
+}
+
+void AtlasPreview::EvictTiles() {
+    if (tiles.size() <= MaxTiles) return;
+    std::vector<std::pair<uint64_t, uint64_t>> order;
+    order.reserve(tiles.size());
+    for (const auto &entry : tiles) {
+        order.emplace_back(entry.second.last_used, entry.first);
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size() - MaxTiles; ++i) {
+        // Tiles drawn this frame are kept even if over the limit
+        if (order[i].first == frame) break;
+        auto it = tiles.find(order[i].second);
+        if (it->second.texture != nullptr)
+            SDL_DestroyTexture(it->second.texture);
+        tiles.erase(it);
+    }
+}
+
+void AtlasPreview::Draw(const Image &image, const SDL_Rect &dst) {
+    if (image.width <= 0 || image.height <= 0 || dst.w <= 0 || dst.h <= 0) {
+        return;
+    }
+    ++frame;
+
+    // Highest level with at least one image pixel per screen pixel, and
+    // no smaller than a tile
+    float scale = float(dst.w) / float(image.width);
+    int level = scale < 1.0f ? int(std::floor(std::log2(1.0f / scale))) : 0;
+    while (level > 0 && LevelSize(image.width, level) < TileSize
+            && LevelSize(image.height, level) < TileSize) {
+        --level;
+    }
+    int level_w = LevelSize(image.width, level);
+    int level_h = LevelSize(image.height, level);
+    int tiles_x = (level_w + TileSize - 1) / TileSize;
+    int tiles_y = (level_h + TileSize - 1) / TileSize;
+
+    int dw, dh;
+    SDL_GetRendererOutputSize(device, &dw, &dh);
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        // Edges are computed from image pixels so tiles do not leave
+        // gaps in between them when scaled
+        int y0 = std::min(ty * TileSize << level, image.height);
+        int y1 = std::min((ty + 1) * TileSize << level, image.height);
+        SDL_Rect to;
+        to.y = dst.y + int(int64_t(y0) * dst.h / image.height);
+        to.h = dst.y + int(int64_t(y1) * dst.h / image.height) - to.y;
+        if (to.y + to.h < 0 || to.y > dh) continue;
+
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            int x0 = std::min(tx * TileSize << level, image.width);
+            int x1 = std::min((tx + 1) * TileSize << level, image.width);
+            to.x = dst.x + int(int64_t(x0) * dst.w / image.width);
+            to.w = dst.x + int(int64_t(x1) * dst.w / image.width) - to.x;
+            if (to.x + to.w < 0 || to.x > dw) continue;
+
+            if (auto *texture = GetTile(image, level, tx, ty)) {
+                SDL_RenderCopy(device, texture, nullptr, &to);
+            }
+        }
+    }
+    EvictTiles();
+}
+
+} // namespace spack
@@ -0,0 +1,80 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_PREVIEW_H
+#define SPACK_PREVIEW_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "SDL.h"
+#include "image.h"
+
+namespace spack {
+
+// Draws an atlas image of any size in the UI. The image is split into
+// tiles that are always small enough to be textures, with a mip level for
+// each power of 2 the view is zoomed out by. Each level is filtered from
+// the one below it. Only the visible tiles of the level being drawn are
+// built and uploaded, and tiles that were not drawn recently are released
+// once there are more than MaxTiles.
+class AtlasPreview {
+public:
+    static constexpr int TileSize = 512;
+    static constexpr size_t MaxTiles = 128;
+
+    explicit AtlasPreview(SDL_Renderer *device) : device(device) {}
+    ~AtlasPreview();
+
+    AtlasPreview(const AtlasPreview &) = delete;
+    AtlasPreview &operator=(const AtlasPreview &) = delete;
+
+    // Releases the tiles after the image changed.
+    void Invalidate();
+
+    // Draws the transparency checkerboard behind the image from a cached
+    // pattern texture, a few copies instead of one rect per cell.
+    void DrawBackdrop(const SDL_Rect &dst);
+
+    // Draws the image scaled to dst.
+    void Draw(const Image &image, const SDL_Rect &dst);
+
+private:
+    struct Tile {
+        SDL_Texture *texture = nullptr;
+        // Filtered pixels of tiles above level 0
+        std::vector<unsigned char> pixels;
+        uint64_t last_used = 0;
+    };
+    SDL_Renderer *device;
+    SDL_Texture *backdrop = nullptr;
+    std::unordered_map<uint64_t, Tile> tiles;
+    uint64_t frame = 0;
+
+    SDL_Texture *GetTile(const Image &image, int level, int tx, int ty);
+    // Filters a tile of a level above 0 from the level below it, using
+    // the tiles of that level that are still cached and building the rest
+    void BuildTile(const Image &image, int level, int tx, int ty,
+                   std::vector<unsigned char> *out);
+    void EvictTiles();
+};
+
+} // namespace spack
+
+#endif // SPACK_PREVIEW_H
@@ -0,0 +1,199 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "profile.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cinttypes>
+
+namespace spack {
+
+std::atomic<bool> profile_enabled{false};
+
+namespace {
+
+struct ProfileEvent {
+    const char *name;
+    int64_t begin;
+    int64_t duration;
+};
+
+// Each thread records to its own buffer so threads do not contend on
+// a shared lock. The lock is only taken by the writer.
+struct ThreadEvents {
+    int id = 0;
+    const char *name = "thread";
+    std::mutex mutex;
+    std::vector<ProfileEvent> events;
+};
+
+struct Profile {
+    // Set during static initialization so startup can be measured
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadEvents>> threads;
+    // Scopes recorded and dropped since the profile was reset
+    std::atomic<size_t> events{0};
+    std::atomic<size_t> dropped{0};
+};
+
+} // namespace
+
+static Profile profile;
+// Buffers are owned by the profile so events outlive their thread
+static thread_local ThreadEvents *thread_events = nullptr;
+static thread_local const char *thread_name = "thread";
+
+static int64_t ProfileTime() {
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        now - profile.start).count();
+}
+
+static ThreadEvents *GetThreadEvents() {
+    if (thread_events == nullptr) {
+        std::lock_guard<std::mutex> lock(profile.mutex);
+        profile.threads.push_back(std::make_unique<ThreadEvents>());
+        thread_events = profile.threads.back().get();
+        thread_events->id = int(profile.threads.size());
+        thread_events->name = thread_name;
+    }
+    return thread_events;
+}
+
+static void Record(const ProfileEvent &event) {
+    if (profile.events.fetch_add(1, std::memory_order_relaxed)
+            >= MaxProfileEvents) {
+        profile.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto *thread = GetThreadEvents();
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    thread->events.push_back(event);
+}
+
+void StartProfile() {
+    profile_enabled = true;
+}
+
+void ProfileStartup() {
+    if (!IsProfiling()) return;
+    Record(ProfileEvent{"startup", 0, ProfileTime()});
+}
+
+void SetProfileThreadName(const char *name) {
+    thread_name = name;
+    if (thread_events != nullptr) {
+        std::lock_guard<std::mutex> lock(thread_events->mutex);
+        thread_events->name = name;
+    }
+}
+
+void ProfileScope::Begin(const char *scope_name) {
+    name = scope_name;
+    begin = ProfileTime();
+}
+
+void ProfileScope::End() {
+    auto end = ProfileTime();
+    Record(ProfileEvent{name, begin, end - begin});
+}
+
+bool WriteProfile(const std::string &filename) {
+    auto *file = fopen(filename.c_str(), "w+");
+    if (file == nullptr) return false;
+
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    fprintf(file, "{\"traceEvents\":[");
+    bool first = true;
+    for (const auto &thread : profile.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",", thread->id, thread->name, thread->id);
+        first = false;
+        for (const auto &e : thread->events) {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64 "}",
+                    e.name, thread->id, e.begin, e.duration);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+std::vector<ProfileTotal> ProfileTotals() {
+    std::vector<ProfileTotal> totals;
+    std::unordered_map<std::string, size_t> index;
+
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    for (const auto &thread : profile.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        for (const auto &e : thread->events) {
+            auto it = index.emplace(e.name, totals.size());
+            if (it.second) totals.push_back(ProfileTotal{e.name});
+            auto &total = totals[it.first->second];
+            total.count++;
+            total.duration += e.duration;
+            total.max = std::max(total.max, e.duration);
+        }
+    }
+    std::sort(totals.begin(), totals.end(),
+              [](const ProfileTotal &a, const ProfileTotal &b) {
+                  return a.duration > b.duration;
+              });
+    return totals;
+}
+
+void ResetProfile() {
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    for (const auto &thread : profile.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        thread->events.clear();
+    }
+    profile.events = 0;
+    profile.dropped = 0;
+}
+
+void PrintProfileSummary() {
+    // Scopes can be nested and run on several threads, so the totals do
+    // not add up to the wall clock time.
+    fprintf(stderr, "%-16s %8s %12s %12s %12s\n",
+            "scope", "calls", "total ms", "avg ms", "max ms");
+    for (const auto &total : ProfileTotals()) {
+        fprintf(stderr, "%-16s %8zu %12.3f %12.3f %12.3f\n",
+                total.name, total.count, total.duration / 1000.0,
+                total.duration / 1000.0 / total.count, total.max / 1000.0);
+    }
+    if (profile.dropped > 0) {
+        fprintf(stderr, "%zu scopes were not recorded, the profile is full\n",
+                profile.dropped.load());
+    }
+}
+
+} // namespace spack
@@ -0,0 +1,99 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_PROFILE_H
+#define SPACK_PROFILE_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace spack {
+
+extern std::atomic<bool> profile_enabled;
+
+// Scopes kept until the profile is reset, later scopes are dropped so long
+// sessions in the editor do not use up memory.
+constexpr size_t MaxProfileEvents = size_t(1) << 20;
+
+struct ProfileTotal {
+    const char *name;
+    size_t count = 0;
+    // Microseconds summed over all threads
+    int64_t duration = 0;
+    int64_t max = 0;
+};
+
+// Starts recording profile scopes, scopes are ignored until this is called.
+void StartProfile();
+
+// Records a "startup" scope from the start of the process up to now.
+void ProfileStartup();
+
+// Names the calling thread in profiles, threads that are not named are
+// shown as "thread". The name must be a string literal.
+void SetProfileThreadName(const char *name);
+
+// Writes the scopes recorded so far in the Chrome trace event format,
+// which can be opened in chrome://tracing or Perfetto.
+bool WriteProfile(const std::string &filename);
+
+// Time spent in each scope, sorted by total time.
+std::vector<ProfileTotal> ProfileTotals();
+
+// Discards the scopes recorded so far.
+void ResetProfile();
+
+// Prints the total time spent in each scope to stderr.
+void PrintProfileSummary();
+
+inline bool IsProfiling() {
+    return profile_enabled.load(std::memory_order_relaxed);
+}
+
+// Records the time from construction to destruction. The name must be a
+// string literal. Costs a single relaxed load if profiling is off.
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name) {
+        if (IsProfiling()) Begin(name);
+    }
+    ~ProfileScope() {
+        if (name != nullptr) End();
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    const char *name = nullptr;
+    int64_t begin = 0;
+
+    void Begin(const char *scope_name);
+    void End();
+};
+
+#define SPACK_PROFILE_CAT2(a, b) a##b
+#define SPACK_PROFILE_CAT(a, b) SPACK_PROFILE_CAT2(a, b)
+#define SPACK_PROFILE(name) \
+    ::spack::ProfileScope SPACK_PROFILE_CAT(profile_scope_, __LINE__)(name)
+
+} // namespace spack
+
+#endif // SPACK_PROFILE_H
@@ -19,11 +19,15 @@
 #include "project.h"
 
 #include <memory>
+#include <vector>
+#include <string>
 #include <cassert>
+#include <mutex>
 
 #include "SDL.h"
 #include "atlas.h"
 #include "io.h"
+#include "manifest.h"
 
 namespace spack {
 
@@ -40,15 +44,23 @@ void Project::LoadEmptyProject(SDL_Renderer *device) {
     current_atlas = 0;
 }
 
-bool Project::Load(SDL_Renderer *device, const std::string &file) {
-    bool ok = LoadProject(device, file, &atlases);
+bool Project::Load(SDL_Renderer *device, const std::string &file,
+                   bool load_sprites, std::string *error) {
+    // Atlases are opened when they are first shown instead of loading
+    // and rendering all of them up front
+    bool ok = LoadProject(device, file, &atlases, false, error);
+    if (ok && atlases.size() == 0 && error != nullptr) {
+        *error = "No atlas lines";
+    }
     if (!ok || atlases.size() == 0) {
         LoadEmptyProject(device);
         return false;
     }
     filename = file;
     current_atlas = 0;
-    atlases[current_atlas]->Render();
+    if (load_sprites) {
+        atlases[current_atlas]->Open();
+    }
     return true;
 }
 
@@ -60,13 +72,16 @@ void Project::RegisterExportFunc(const std::string &name, AtlasExporter fn) {
     exporters.push_back(std::make_pair(name, fn));
 }
 
-bool Project::ExportAllAtlases() const {
-    bool error = false;
+bool Project::ExportAllAtlases(bool force) const {
+    ExportQueue queue;
+    QueueExports(&queue, force);
+    return queue.Finish().size() == 0;
+}
+
+void Project::QueueExports(ExportQueue *queue, bool force) const {
     for (const auto &atlas : atlases) {
-        assert(atlas->exporter >= 0 && atlas->exporter < exporters.size());
-        error = !atlas->Export(exporters[atlas->exporter].second) || error;
+        queue->Add(*this, atlas.get(), force);
     }
-    return !error;
 }
 
 std::unique_ptr<Atlas> Project::MakeEmptyAtlas(SDL_Renderer *device) const {
@@ -88,4 +103,66 @@ void Project::Error(const char *id, const std::string &msg) {
     error_msg = msg;
 }
 
+ExportQueue::ExportQueue(int threads)
+    : own_workers(std::make_unique<ThreadPool>(threads)),
+      own_writer(std::make_unique<ThreadPool>(1, "writer")),
+      workers(own_workers.get()),
+      writer(own_writer.get()) {}
+
+ExportQueue::ExportQueue(ThreadPool *workers, ThreadPool *writer)
+    : workers(workers), writer(writer) {}
+
+void ExportQueue::Add(const Project &project, Atlas *atlas, bool force) {
+    assert(atlas->exporter < project.exporters.size());
+    auto fn = project.exporters[atlas->exporter].second;
+    results.push_back(Result{atlas->output_file, true});
+    auto *result = &results.back();
+    atlas->export_status = Export_None;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++pending;
+    }
+
+    workers->Run([this, atlas, fn, force, result] {
+        if (!force && IsUpToDate(*atlas)) {
+            atlas->export_status = Export_UpToDate;
+            Done();
+            return;
+        }
+        auto data = std::make_shared<std::vector<unsigned char>>();
+        if (!atlas->Build(force) || !atlas->Encode(data.get())) {
+            result->ok = false;
+            atlas->export_status = Export_Failed;
+            Done();
+            return;
+        }
+        writer->Run([this, atlas, fn, result, data] {
+            result->ok = atlas->WriteOutputs(fn, *data);
+            atlas->export_status = result->ok ? Export_Written : Export_Failed;
+            Done();
+        });
+    });
+}
+
+void ExportQueue::Done() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0) {
+        done.notify_all();
+    }
+}
+
+std::vector<std::string> ExportQueue::Finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    lock.unlock();
+
+    std::vector<std::string> failed;
+    for (const auto &result : results) {
+        if (!result.ok)
+            failed.push_back(result.output_file);
+    }
+    results.clear();
+    return failed;
+}
+
 } // namespace spack
@@ -20,13 +20,19 @@
 #define SPACK_PROJECT_H
 
 #include <memory>
+#include <deque>
 #include <cassert>
+#include <mutex>
+#include <condition_variable>
 
 #include "SDL.h"
 #include "atlas.h"
+#include "jobs.h"
 
 namespace spack {
 
+class ExportQueue;
+
 class Project {
 public:
     std::string filename;
@@ -40,11 +46,18 @@ public:
     Project();
 
     void LoadEmptyProject(SDL_Renderer *device);
-    bool Load(SDL_Renderer *device, const std::string &file);
+    // Opens the first atlas if load_sprites is true, see Atlas::Open.
+    // Other atlases need to be opened before they are used. If the project
+    // cannot be loaded error is set to the reason, see LoadProject.
+    bool Load(SDL_Renderer *device, const std::string &file,
+              bool load_sprites = true, std::string *error = nullptr);
     bool Save() const;
 
     void RegisterExportFunc(const std::string &name, AtlasExporter fn);
-    bool ExportAllAtlases() const;
+    // Atlases that are up to date with their build manifest are skipped
+    // unless force is true.
+    bool ExportAllAtlases(bool force = true) const;
+    void QueueExports(ExportQueue *queue, bool force = true) const;
 
     void AddAtlas(std::unique_ptr<Atlas> atlas);
     std::unique_ptr<Atlas> MakeEmptyAtlas(SDL_Renderer *device) const;
@@ -53,6 +66,44 @@ public:
     void Error(const char *id, const std::string &msg);
 };
 
+// Exports atlases on a pool of worker threads. Atlases are built and
+// encoded by the workers while a separate thread writes the outputs, so
+// encoding one atlas overlaps with writing another.
+class ExportQueue {
+public:
+    explicit ExportQueue(int threads = 0);
+    // Shares the thread pools with other queues, each queue only waits
+    // for its own atlases. The writer must have a single thread.
+    ExportQueue(ThreadPool *workers, ThreadPool *writer);
+
+    ExportQueue(const ExportQueue &) = delete;
+    ExportQueue &operator=(const ExportQueue &) = delete;
+
+    void Add(const Project &project, Atlas *atlas, bool force = true);
+
+    // Waits until all atlases are exported. Returns the atlas files of the
+    // atlases that failed to export in the order they were added.
+    std::vector<std::string> Finish();
+
+private:
+    struct Result {
+        std::string output_file;
+        bool ok = true;
+    };
+    std::unique_ptr<ThreadPool> own_workers;
+    std::unique_ptr<ThreadPool> own_writer;
+    ThreadPool *workers;
+    ThreadPool *writer;
+    // Deque so results keep their address while jobs are running
+    std::deque<Result> results;
+
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+
+    void Done();
+};
+
 inline const std::unique_ptr<Atlas> &Project::GetAtlas() const {
     assert(current_atlas >= 0 && current_atlas < atlases.size());
     return atlases[current_atlas];
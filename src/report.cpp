@@ -0,0 +1,138 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "report.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cinttypes>
+
+#include "atlas.h"
+#include "image.h"
+#include "manifest.h"
+#include "project.h"
+
+namespace spack {
+
+double Occupancy(const AtlasStats &stats) {
+    int64_t area = int64_t(stats.width) * stats.height;
+    return area > 0 ? double(stats.sprite_area) / area : 0.0;
+}
+
+int64_t WastedArea(const AtlasStats &stats) {
+    return int64_t(stats.width) * stats.height - stats.padded_area;
+}
+
+size_t EstimateVram(const AtlasStats &stats) {
+    return size_t(stats.width) * stats.height * 4;
+}
+
+bool ReadCachedStats(const Atlas &atlas, AtlasStats *stats) {
+    Manifest manifest;
+    if (!ReadManifest(ManifestPath(atlas), &manifest)) {
+        return false;
+    }
+    int p = atlas.padding;
+    *stats = AtlasStats{};
+    stats->width = manifest.width;
+    stats->height = manifest.height;
+    stats->sprites = int(manifest.inputs.size());
+    for (const auto &in : manifest.inputs) {
+        stats->sprite_area += int64_t(in.width) * in.height;
+        stats->padded_area += int64_t(in.width + 2*p) * (in.height + 2*p);
+    }
+    stats->cached_layout = true;
+    return true;
+}
+
+static void WriteString(FILE *file, const std::string &str) {
+    fputc('"', file);
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if ((unsigned char)c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Indexed by ExportStatus
+static const char *ExportStatusName[] {
+    "not_exported", "up_to_date", "exported", "failed"
+};
+
+static void WriteAtlas(FILE *file, const std::string &project,
+                       const Atlas &atlas) {
+    // Atlases skipped because they were up to date were not rendered
+    auto stats = atlas.stats;
+    if (atlas.export_status == Export_UpToDate) {
+        ReadCachedStats(atlas, &stats);
+    }
+
+    fprintf(file, "{\"project\":");
+    WriteString(file, project);
+    fprintf(file, ",\"atlas\":");
+    WriteString(file, atlas.output_file);
+    fprintf(file, ",\"image\":");
+    WriteString(file, atlas.output_image);
+    fprintf(file, ",\"format\":\"%s\"", ImageExt[atlas.image_format]);
+    fprintf(file, ",\"status\":\"%s\"",
+            ExportStatusName[atlas.export_status]);
+    fprintf(file, ",\"width\":%d,\"height\":%d", stats.width, stats.height);
+    fprintf(file, ",\"sprites\":%d", stats.sprites);
+    fprintf(file, ",\"padding\":%d", atlas.padding);
+    fprintf(file, ",\"sprite_area\":%" PRId64, stats.sprite_area);
+    fprintf(file, ",\"padded_area\":%" PRId64, stats.padded_area);
+    fprintf(file, ",\"wasted_area\":%" PRId64, WastedArea(stats));
+    fprintf(file, ",\"occupancy\":%.4f", Occupancy(stats));
+    fprintf(file, ",\"cached_layout\":%s",
+            stats.cached_layout ? "true" : "false");
+    fprintf(file, ",\"pack_retries\":%d", stats.pack_retries);
+    fprintf(file, ",\"peak_mask_bytes\":%zu", stats.peak_mask_bytes);
+    fprintf(file, ",\"image_bytes\":%zu",
+            size_t(stats.width) * stats.height * 4);
+    fprintf(file, ",\"vram_bytes\":%zu}",
+            EstimateVram(stats));
+}
+
+bool WriteReport(const std::string &filename,
+                 const std::vector<std::unique_ptr<Project>> &projects) {
+    auto *file = fopen(filename.c_str(), "w+");
+    if (file == nullptr) return false;
+
+    fprintf(file, "{\"atlases\":[");
+    bool first = true;
+    for (const auto &project : projects) {
+        for (const auto &atlas : project->atlases) {
+            fprintf(file, first ? "\n" : ",\n");
+            WriteAtlas(file, project->filename, *atlas);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
+} // namespace spack
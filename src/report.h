@@ -0,0 +1,55 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_REPORT_H
+#define SPACK_REPORT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "atlas.h"
+#include "image.h"
+
+namespace spack {
+
+class Project;
+
+// Share of the atlas covered by sprites without padding, between 0 and 1.
+double Occupancy(const AtlasStats &stats);
+
+// Area of the atlas not covered by sprites or their padding.
+int64_t WastedArea(const AtlasStats &stats);
+
+// Memory used by the atlas texture once it is uploaded to the GPU. None
+// of the image formats are GPU compressed, renderers upload them as RGBA8
+// textures.
+size_t EstimateVram(const AtlasStats &stats);
+
+// Statistics of an atlas that was not rendered, read from the manifest
+// of its last export. The layout is always cached.
+bool ReadCachedStats(const Atlas &atlas, AtlasStats *stats);
+
+// Writes the statistics of every atlas in the projects as JSON.
+bool WriteReport(const std::string &filename,
+                 const std::vector<std::unique_ptr<Project>> &projects);
+
+} // namespace spack
+
+#endif // SPACK_REPORT_H
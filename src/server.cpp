@@ -0,0 +1,485 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "server.h"
+
+#include <cstdio>
+#include <string>
+
+#include "SDL.h"
+
+#ifdef _WIN32
+
+namespace spack {
+
+int Serve(SDL_Renderer *, const std::string &, int, size_t) {
+    fprintf(stderr, "error: -serve is not supported on this platform\n");
+    return 1;
+}
+
+int SendRequest(const std::string &, const std::string &) {
+    fprintf(stderr, "error: -client is not supported on this platform\n");
+    return 1;
+}
+
+} // namespace spack
+
+#else
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <filesystem>
+#include <system_error>
+#include <sstream>
+#include <cstring>
+#include <csignal>
+#include <cinttypes>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "io.h"
+#include "jobs.h"
+#include "manifest.h"
+#include "project.h"
+
+namespace spack {
+
+namespace {
+
+struct Request {
+    std::string cwd;
+    bool force = false;
+    std::vector<std::string> export_files;
+    // Inline project
+    std::string project_base;
+    std::string project_data;
+    bool has_project = false;
+    bool stats = false;
+    bool quit = false;
+};
+
+struct ServedProject {
+    // Held while the project is exported
+    std::mutex mutex;
+    std::unique_ptr<Project> project;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// Budget of the image cache if the daemon is started without -max-memory,
+// images of projects that are no longer exported are dropped past it.
+constexpr size_t DefaultCacheBudget = size_t(1024) << 20;
+
+class Server {
+public:
+    Server(SDL_Renderer *device, int threads, size_t max_memory)
+        : device(device), workers(threads), max_memory(max_memory) {
+        cache.SetBudget(max_memory > 0 ? max_memory : DefaultCacheBudget);
+    }
+
+    bool Listen(const std::string &socket_path);
+    void Run();
+
+private:
+    SDL_Renderer *device;
+    ImageCache cache;
+    ThreadPool workers;
+    ThreadPool writer{1, "writer"};
+
+    // Projects are kept loaded between requests so unchanged atlases keep
+    // their rendered image in memory.
+    std::unordered_map<std::string, std::unique_ptr<ServedProject>> projects;
+    std::mutex projects_mutex;
+
+    // Memory for decoded sprites in bytes, 0 for no limit
+    size_t max_memory;
+
+    int listen_fd = -1;
+    std::atomic<bool> stop{false};
+
+    // Threads of the connected clients, only used by Run. Threads add
+    // themselves to finished_clients when done and are joined by Run, so
+    // none of them outlive the server.
+    std::vector<std::thread> clients;
+    std::vector<std::thread::id> finished_clients;
+    std::mutex clients_mutex;
+
+    void JoinFinishedClients();
+
+    void Serve(int fd);
+    std::string Handle(const Request &request);
+    ServedProject *GetProject(const std::string &key);
+    bool LoadProject(ServedProject *served, const std::string &filename,
+                     const std::string &cwd, std::string *error);
+};
+
+} // namespace
+
+static double ElapsedMs(std::chrono::high_resolution_clock::time_point begin) {
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+static bool MakeAddress(const std::string &socket_path, sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "error: Socket path is too long %s\n",
+                socket_path.c_str());
+        return false;
+    }
+    memcpy(addr->sun_path, socket_path.c_str(), socket_path.size());
+    return true;
+}
+
+static bool WriteAll(int fd, const std::string &data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        auto n = write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        offset += size_t(n);
+    }
+    return true;
+}
+
+// Reads a line without the line ending, buffer holds data read past the
+// end of the line. Returns false at the end of the stream.
+static bool ReadLine(int fd, std::string *buffer, std::string *line) {
+    for (;;) {
+        auto sep = buffer->find('\n');
+        if (sep != std::string::npos) {
+            *line = buffer->substr(0, sep);
+            buffer->erase(0, sep + 1);
+            if (line->size() > 0 && line->back() == '\r') line->pop_back();
+            return true;
+        }
+        char chunk[4096];
+        auto n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (buffer->size() == 0) return false;
+            *line = std::move(*buffer);
+            buffer->clear();
+            return true;
+        }
+        buffer->append(chunk, size_t(n));
+    }
+}
+
+static bool ReadRequest(int fd, Request *request) {
+    std::string buffer, line;
+    while (ReadLine(fd, &buffer, &line)) {
+        if (line == "end") return true;
+        if (request->has_project) {
+            request->project_data += line;
+            request->project_data += '\n';
+            continue;
+        }
+        auto sep = line.find(' ');
+        auto key = line.substr(0, sep);
+        auto value = sep == std::string::npos ? "" : line.substr(sep + 1);
+
+        if (key == "cwd") {
+            request->cwd = value;
+        } else if (key == "force") {
+            request->force = true;
+        } else if (key == "export") {
+            request->export_files.push_back(value);
+        } else if (key == "project") {
+            request->project_base = value;
+            request->has_project = true;
+        } else if (key == "stats") {
+            request->stats = true;
+        } else if (key == "quit") {
+            request->quit = true;
+        } else if (key != "" && key[0] != '#') {
+            return false;
+        }
+    }
+    return false;
+}
+
+static std::string ResolvePath(const std::string &cwd,
+                               const std::string &filename) {
+    std::filesystem::path path(filename);
+    if (cwd == "" || path.is_absolute()) {
+        return NormalizePath(filename);
+    }
+    return (std::filesystem::path(cwd) / path).lexically_normal().u8string();
+}
+
+// Outputs are written relative to the directory of the client. Atlases
+// stream their sprites if the memory of the daemon is limited, as with
+// -export.
+static void SetupAtlases(Project *project, const std::string &cwd,
+                         bool stream_sprites) {
+    for (auto &atlas : project->atlases) {
+        atlas->working_dir = cwd;
+        atlas->stream_sprites = stream_sprites;
+    }
+}
+
+bool Server::Listen(const std::string &socket_path) {
+    sockaddr_un addr;
+    if (!MakeAddress(socket_path, &addr)) return false;
+
+    // A socket file left behind by a daemon that is no longer running
+    // is replaced, a running daemon is not.
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(probe);
+        fprintf(stderr, "error: A daemon is already listening on %s\n",
+                socket_path.c_str());
+        return false;
+    }
+    if (probe >= 0) close(probe);
+    unlink(socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0
+            || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0
+            || listen(listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "error: Failed to listen on %s: %s\n",
+                socket_path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Server::Run() {
+    SetImageCache(&cache);
+    while (!stop) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        JoinFinishedClients();
+        // Requests only wait on the worker pools, clients get their own
+        // thread so a slow request does not hold up the others.
+        clients.emplace_back([this, fd] {
+            Serve(fd);
+            close(fd);
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            finished_clients.push_back(std::this_thread::get_id());
+        });
+    }
+    for (auto &client : clients) {
+        client.join();
+    }
+    clients.clear();
+
+    close(listen_fd);
+    SetImageCache(nullptr);
+}
+
+void Server::JoinFinishedClients() {
+    std::vector<std::thread::id> finished;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        finished.swap(finished_clients);
+    }
+    for (auto id : finished) {
+        auto it = std::find_if(clients.begin(), clients.end(),
+            [id](const std::thread &client) {
+                return client.get_id() == id;
+            });
+        it->join();
+        clients.erase(it);
+    }
+}
+
+void Server::Serve(int fd) {
+    Request request;
+    if (!ReadRequest(fd, &request)) {
+        WriteAll(fd, "e Invalid request\nerror\n");
+        return;
+    }
+    WriteAll(fd, Handle(request));
+    if (request.quit) {
+        stop = true;
+        // Wakes up accept
+        shutdown(listen_fd, SHUT_RDWR);
+    }
+}
+
+ServedProject *Server::GetProject(const std::string &key) {
+    std::lock_guard<std::mutex> lock(projects_mutex);
+    auto &served = projects[key];
+    if (served == nullptr) {
+        served = std::make_unique<ServedProject>();
+    }
+    return served.get();
+}
+
+bool Server::LoadProject(ServedProject *served, const std::string &filename,
+                         const std::string &cwd, std::string *error) {
+    uint64_t size;
+    int64_t mtime;
+    if (!StatFile(filename, &size, &mtime)) {
+        served->project = nullptr;
+        *error = "File not found";
+        return false;
+    }
+    if (served->project != nullptr && served->size == size
+            && served->mtime == mtime) {
+        return true;
+    }
+    auto project = std::make_unique<Project>();
+    if (!project->Load(device, filename, false, error)) {
+        served->project = nullptr;
+        return false;
+    }
+    SetupAtlases(project.get(), cwd, max_memory > 0);
+    served->project = std::move(project);
+    served->size = size;
+    served->mtime = mtime;
+    return true;
+}
+
+std::string Server::Handle(const Request &request) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    std::string response;
+    bool ok = true;
+
+    // Projects are locked in a fixed order so two requests exporting the
+    // same projects cannot deadlock.
+    std::vector<std::pair<std::string, ServedProject *>> served;
+    for (const auto &file : request.export_files) {
+        auto filename = ResolvePath(request.cwd, file);
+        served.emplace_back(filename, GetProject(request.cwd + '\n' + filename));
+    }
+    std::sort(served.begin(), served.end());
+    served.erase(std::unique(served.begin(), served.end()), served.end());
+
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (auto &it : served) {
+        locks.emplace_back(it.second->mutex);
+    }
+
+    ExportQueue queue(&workers, &writer);
+    for (auto &it : served) {
+        std::string error;
+        if (!LoadProject(it.second, it.first, request.cwd, &error)) {
+            response += "e Failed to load project " + it.first + ": "
+                      + error + "\n";
+            ok = false;
+            continue;
+        }
+        it.second->project->QueueExports(&queue, request.force);
+    }
+
+    Project inline_project;
+    if (request.has_project) {
+        auto base = ResolvePath(request.cwd, request.project_base) + "/";
+        std::string error = "No atlas lines";
+        if (ParseProject(device, request.project_data, base,
+                         &inline_project.atlases, &error)
+                && inline_project.atlases.size() > 0) {
+            SetupAtlases(&inline_project, request.cwd, max_memory > 0);
+            inline_project.QueueExports(&queue, request.force);
+        } else {
+            response += "e Failed to load inline project: " + error + "\n";
+            ok = false;
+        }
+    }
+    auto load_ms = ElapsedMs(begin);
+
+    for (const auto &output_file : queue.Finish()) {
+        response += "e Failed to export " + output_file + "\n";
+        ok = false;
+    }
+    auto export_ms = ElapsedMs(begin) - load_ms;
+    locks.clear();
+
+    auto stats = cache.Stats();
+    char line[256];
+    snprintf(line, sizeof(line), "t %.3f %.3f\n", load_ms, export_ms);
+    response += line;
+    snprintf(line, sizeof(line), "c %zu %zu %" PRIu64 " %" PRIu64 "\n",
+             stats.images, stats.bytes, stats.hits, stats.misses);
+    response += line;
+    response += ok ? "ok\n" : "error\n";
+    return response;
+}
+
+int Serve(SDL_Renderer *device, const std::string &socket_path, int threads,
+          size_t max_memory) {
+    // Clients closing the connection early must not stop the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server(device, threads, max_memory);
+    if (!server.Listen(socket_path)) {
+        return 1;
+    }
+    printf("Listening on %s\n", socket_path.c_str());
+    fflush(stdout);
+    server.Run();
+    unlink(socket_path.c_str());
+    return 0;
+}
+
+int SendRequest(const std::string &socket_path, const std::string &request) {
+    sockaddr_un addr;
+    if (!MakeAddress(socket_path, &addr)) return 1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "error: Failed to connect to %s: %s\n",
+                socket_path.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    std::error_code ec;
+    auto cwd = std::filesystem::current_path(ec).u8string();
+    if (!WriteAll(fd, "cwd " + cwd + "\n" + request + "\nend\n")) {
+        fprintf(stderr, "error: Failed to send request\n");
+        close(fd);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    std::string buffer, line;
+    bool ok = false;
+    while (ReadLine(fd, &buffer, &line)) {
+        if (line.compare(0, 2, "e ") == 0) {
+            fprintf(stderr, "error: %s\n", line.c_str() + 2);
+        } else if (line == "ok") {
+            ok = true;
+        } else if (line != "error") {
+            printf("%s\n", line.c_str());
+        }
+    }
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+} // namespace spack
+
+#endif // _WIN32
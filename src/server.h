@@ -0,0 +1,61 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_SERVER_H
+#define SPACK_SERVER_H
+
+#include <string>
+
+#include "SDL.h"
+
+namespace spack {
+
+// Requests are sent to the daemon as lines of text ending with a line
+// containing "end". The daemon answers with lines of text and closes the
+// connection.
+//
+//   cwd <dir>       Relative paths in the request and relative output paths
+//                   of the atlases are relative to dir.
+//   force           Exports atlases even if they are up to date.
+//   export <file>   Exports a project file. Several projects can be
+//                   exported by the same request.
+//   project <dir>   Exports the project in the lines following this one,
+//                   sprite paths are relative to dir.
+//   stats           Only returns statistics.
+//   quit            Stops the daemon once running requests are done.
+//
+// The response has an "e <message>" line for each error, followed by
+// "t <load ms> <export ms>" with the time taken by the request,
+// "c <images> <bytes> <hits> <misses>" with the state of the image cache
+// and "ok" or "error" depending on whether the request succeeded.
+
+// Runs a daemon serving requests on a Unix domain socket until it gets a
+// quit request. Decoded images and projects are kept in memory between
+// requests. Atlases stream their sprites and the image cache is limited
+// to max_memory bytes if it is not 0, otherwise the cache has a default
+// budget. Returns the process exit code.
+int Serve(SDL_Renderer *device, const std::string &socket_path, int threads,
+          size_t max_memory);
+
+// Sends a request to the daemon and prints the response, errors are
+// written to stderr. Returns the process exit code.
+int SendRequest(const std::string &socket_path, const std::string &request);
+
+} // namespace spack
+
+#endif // SPACK_SERVER_H
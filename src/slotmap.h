@@ -0,0 +1,161 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_SLOTMAP_H
+#define SPACK_SLOTMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+namespace spack {
+
+// Refers to an element of a SlotMap. Stays valid while the element exists
+// even if other elements are removed, and never refers to another element
+// after it was removed.
+struct SlotHandle {
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const SlotHandle &other) const {
+        return slot == other.slot && generation == other.generation;
+    }
+    bool operator!=(const SlotHandle &other) const {
+        return !(*this == other);
+    }
+};
+
+// Elements are stored densely so they can be iterated and indexed like a
+// vector, and looked up by handle in O(1). Removing an element is O(1) and
+// moves the last element into its place, so dense indices are only stable
+// until an element is removed.
+template <typename T>
+class SlotMap {
+public:
+    SlotHandle Insert(T value);
+    void Remove(SlotHandle handle);
+    bool Contains(SlotHandle handle) const;
+
+    // Dense index of the element, the handle must be valid.
+    size_t IndexOf(SlotHandle handle) const;
+    SlotHandle HandleAt(size_t index) const;
+
+    T &Get(SlotHandle handle) { return values[IndexOf(handle)]; }
+    const T &Get(SlotHandle handle) const { return values[IndexOf(handle)]; }
+
+    T &operator[](size_t index) { return values[index]; }
+    const T &operator[](size_t index) const { return values[index]; }
+
+    size_t size() const { return values.size(); }
+    T &back() { return values.back(); }
+    void reserve(size_t n);
+    void clear();
+
+    typename std::vector<T>::iterator begin() { return values.begin(); }
+    typename std::vector<T>::iterator end() { return values.end(); }
+    typename std::vector<T>::const_iterator begin() const {
+        return values.begin();
+    }
+    typename std::vector<T>::const_iterator end() const {
+        return values.end();
+    }
+
+private:
+    struct Slot {
+        uint32_t index;
+        // Incremented when the slot is freed so old handles stop matching
+        uint32_t generation;
+    };
+    std::vector<T> values;
+    // Slot of each element in values
+    std::vector<uint32_t> value_slots;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+};
+
+template <typename T>
+SlotHandle SlotMap<T>::Insert(T value) {
+    uint32_t slot;
+    if (free_slots.size() > 0) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = slots.size();
+        slots.push_back(Slot{0, 0});
+    }
+    slots[slot].index = values.size();
+    values.push_back(std::move(value));
+    value_slots.push_back(slot);
+    return SlotHandle{slot, slots[slot].generation};
+}
+
+template <typename T>
+void SlotMap<T>::Remove(SlotHandle handle) {
+    assert(Contains(handle));
+    uint32_t index = slots[handle.slot].index;
+    uint32_t last = values.size() - 1;
+    if (index != last) {
+        values[index] = std::move(values[last]);
+        value_slots[index] = value_slots[last];
+        slots[value_slots[index]].index = index;
+    }
+    values.pop_back();
+    value_slots.pop_back();
+    slots[handle.slot].generation++;
+    free_slots.push_back(handle.slot);
+}
+
+template <typename T>
+bool SlotMap<T>::Contains(SlotHandle handle) const {
+    return handle.slot < slots.size()
+        && slots[handle.slot].generation == handle.generation;
+}
+
+template <typename T>
+size_t SlotMap<T>::IndexOf(SlotHandle handle) const {
+    assert(Contains(handle));
+    return slots[handle.slot].index;
+}
+
+template <typename T>
+SlotHandle SlotMap<T>::HandleAt(size_t index) const {
+    uint32_t slot = value_slots[index];
+    return SlotHandle{slot, slots[slot].generation};
+}
+
+template <typename T>
+void SlotMap<T>::reserve(size_t n) {
+    values.reserve(n);
+    value_slots.reserve(n);
+    slots.reserve(n);
+}
+
+template <typename T>
+void SlotMap<T>::clear() {
+    // Slots are kept so handles to removed elements stay invalid
+    for (uint32_t slot : value_slots) {
+        slots[slot].generation++;
+        free_slots.push_back(slot);
+    }
+    values.clear();
+    value_slots.clear();
+}
+
+} // namespace spack
+
+#endif // SPACK_SLOTMAP_H
@@ -17,7 +17,14 @@
 // 3. This notice may not be removed or altered from any source distribution.
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <memory>
 
 #include "SDL.h"
 #include "imgui/imgui_sdl.h"
@@ -25,6 +32,13 @@
 
 #include "ui.h"
 #include "project.h"
+#include "watch.h"
+#include "io.h"
+#include "cache.h"
+#include "manifest.h"
+#include "server.h"
+#include "profile.h"
+#include "report.h"
 
 int UiMain(SDL_Renderer *device, const char *filename = nullptr) {
     ImGui::CreateContext();
@@ -46,37 +60,335 @@ int UiMain(SDL_Renderer *device, const char *filename = nullptr) {
     return 0;
 }
 
-int CliMain(SDL_Renderer *device, const char *filename) {
+struct CliOptions {
+    std::vector<std::string> export_files;
+    const char *watch_file = nullptr;
+    const char *project_file = nullptr;
+    const char *serve_socket = nullptr;
+    const char *client_socket = nullptr;
+    const char *profile_file = nullptr;
+    const char *report_file = nullptr;
+    bool force = false;
+    bool validate = false;
+    // Number of threads used to export atlases, 0 uses one per core
+    int threads = 0;
+    // Memory for decoded sprites in bytes, 0 for no limit
+    size_t max_memory = 0;
+};
+
+// Atlases stream their sprites when memory is limited, so only the sprites
+// that are being drawn and the images kept by the cache are in memory.
+static void LimitMemory(spack::Project *project, const CliOptions &opt) {
+    for (auto &atlas : project->atlases) {
+        atlas->stream_sprites = opt.max_memory > 0;
+    }
+}
+
+static void SaveProfile(const CliOptions &opt) {
+    if (opt.profile_file == nullptr) return;
+    if (!spack::WriteProfile(opt.profile_file)) {
+        fprintf(stderr, "error: Failed to write %s\n", opt.profile_file);
+        return;
+    }
+    spack::PrintProfileSummary();
+}
+
+static bool ReportExportErrors(const std::vector<std::string> &failed) {
+    for (const auto &output_file : failed) {
+        fprintf(stderr, "error: Failed to export %s\n", output_file.c_str());
+    }
+    return failed.size() == 0;
+}
+
+// Reads a list of project files, one per line.
+static bool ReadExportList(const char *filename,
+                           std::vector<std::string> *files) {
+    auto *file = fopen(filename, "r");
+    if (file == nullptr) return false;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        std::string path = line;
+        while (path.size() > 0 && (path.back() == '\n' || path.back() == '\r'))
+            path.pop_back();
+        if (path == "" || path[0] == '#') continue;
+        files->push_back(path);
+    }
+    fclose(file);
+    return true;
+}
+
+// Checks the layouts recorded by the last export of each atlas, which also
+// covers atlases that were skipped because they were up to date.
+static bool ValidateExports(
+        const std::vector<std::unique_ptr<spack::Project>> &projects) {
+    bool ok = true;
+    for (const auto &project : projects) {
+        for (const auto &atlas : project->atlases) {
+            spack::Manifest manifest;
+            std::string error;
+            if (!spack::ReadManifest(spack::ManifestPath(*atlas), &manifest)) {
+                // Failed exports were already reported
+                continue;
+            }
+            if (!spack::ValidateManifestLayout(manifest, atlas->padding,
+                                               &error)) {
+                fprintf(stderr, "error: Invalid layout in %s: %s\n",
+                        atlas->output_file.c_str(), error.c_str());
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+int CliMain(SDL_Renderer *device, const CliOptions &opt) {
+    // All projects share the same decoded images, so sprites used by
+    // several projects are only decoded once.
+    spack::ImageCache cache;
+    cache.SetBudget(opt.max_memory);
+    spack::SetImageCache(&cache);
+
+    std::vector<std::unique_ptr<spack::Project>> projects;
+    spack::ExportQueue queue(opt.threads);
+    bool ok = true;
+
+    for (const auto &filename : opt.export_files) {
+        auto project = std::make_unique<spack::Project>();
+        std::string error;
+        // Sprites are loaded on export, only for atlases that are out of date.
+        if (!project->Load(device, filename, false, &error)) {
+            fprintf(stderr, "error: Failed to load project %s: %s\n",
+                    filename.c_str(), error.c_str());
+            ok = false;
+            continue;
+        }
+        LimitMemory(project.get(), opt);
+        // Atlases start exporting while the next project is loaded
+        project->QueueExports(&queue, opt.force);
+        projects.push_back(std::move(project));
+    }
+    ok = ReportExportErrors(queue.Finish()) && ok;
+    if (opt.validate) {
+        ok = ValidateExports(projects) && ok;
+    }
+    if (opt.report_file != nullptr
+            && !spack::WriteReport(opt.report_file, projects)) {
+        fprintf(stderr, "error: Failed to write %s\n", opt.report_file);
+        ok = false;
+    }
+    spack::SetImageCache(nullptr);
+    return ok ? 0 : 1;
+}
+
+static void WatchProjectFiles(const spack::Project &project,
+                              spack::FileWatcher *watcher) {
+    watcher->Clear();
+    watcher->Add(project.filename);
+    for (const auto &atlas : project.atlases) {
+        for (const auto &sprite : atlas->sprites) {
+            watcher->Add(sprite.filename);
+        }
+    }
+}
+
+// Unloads the sprites whose file changed so they are decoded again, the
+// atlas may not find them changed if it is packed again instead of using
+// its manifest. Returns true if any sprite was unloaded.
+static bool UnloadChangedSprites(spack::Atlas *atlas,
+                                 const std::unordered_set<std::string> &files) {
+    bool changed = false;
+    for (size_t i = 0; i < atlas->sprites.size(); ++i) {
+        if (files.count(spack::NormalizePath(atlas->sprites[i].filename)) > 0) {
+            atlas->UnloadSprite(i);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Cells of a sheet are found when the project is loaded, so the project
+// is loaded again if a sheet changes.
+static bool UsesAnySheet(const spack::Project &project,
+                         const std::unordered_set<std::string> &files) {
+    for (const auto &atlas : project.atlases) {
+        for (const auto &source : atlas->sources) {
+            if (source.type == spack::Source_Sheet
+                    && files.count(spack::NormalizePath(source.pattern)) > 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+int WatchMain(SDL_Renderer *device, const CliOptions &opt) {
+    // Debounce window for editors that write a file in several steps
+    constexpr int DebounceMs = 30;
+    const char *filename = opt.watch_file;
+
+    // Sprites that did not change are not decoded again when the project
+    // is reloaded
+    spack::ImageCache cache;
+    cache.SetBudget(opt.max_memory);
+    spack::SetImageCache(&cache);
+
     spack::Project project;
-    if (!project.Load(device, filename)) {
-        fprintf(stderr, "error: Failed to load project %s\n", filename);
+    std::string error;
+    if (!project.Load(device, filename, false, &error)) {
+        fprintf(stderr, "error: Failed to load project %s: %s\n", filename,
+                error.c_str());
+        spack::SetImageCache(nullptr);
         return 1;
     }
-    if (!project.ExportAllAtlases()) {
-        fprintf(stderr, "error: Failed to export atlases\n");
-        return 1;
+    LimitMemory(&project, opt);
+    spack::ExportQueue queue(opt.threads);
+    project.QueueExports(&queue, opt.force);
+    ReportExportErrors(queue.Finish());
+    SaveProfile(opt);
+
+    spack::FileWatcher watcher;
+    auto project_file = spack::NormalizePath(filename);
+    WatchProjectFiles(project, &watcher);
+    printf("Watching %s\n", filename);
+    fflush(stdout);
+
+    for (;;) {
+        auto changed = watcher.Wait(DebounceMs);
+        if (changed.size() == 0) {
+            fprintf(stderr, "error: Failed to watch project files\n");
+            spack::SetImageCache(nullptr);
+            return 1;
+        }
+        // Each rebuild is profiled on its own, the events of earlier
+        // ones were already written
+        spack::ResetProfile();
+        auto begin = std::chrono::high_resolution_clock::now();
+        std::unordered_set<std::string> files(changed.begin(), changed.end());
+
+        if (files.count(project_file) > 0 || UsesAnySheet(project, files)) {
+            // Atlases that did not change are skipped by their manifest. The
+            // previous project is kept until the project loads again.
+            spack::Project reloaded;
+            if (!reloaded.Load(device, filename, false, &error)) {
+                fprintf(stderr, "error: Failed to load project %s: %s\n",
+                        filename, error.c_str());
+                continue;
+            }
+            project = std::move(reloaded);
+            LimitMemory(&project, opt);
+            project.QueueExports(&queue, false);
+            WatchProjectFiles(project, &watcher);
+        } else {
+            for (const auto &atlas : project.atlases) {
+                if (UnloadChangedSprites(atlas.get(), files)) {
+                    queue.Add(project, atlas.get(), false);
+                }
+            }
+        }
+        ReportExportErrors(queue.Finish());
+        auto end = std::chrono::high_resolution_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            end - begin).count();
+        printf("Exported in %dms\n", int(ms));
+        fflush(stdout);
+        // The watcher only stops when killed, write the profile of every
+        // rebuild
+        SaveProfile(opt);
     }
     return 0;
 }
 
+// Sends the projects to export to a daemon started with -serve, or the
+// request read from stdin if there are no projects.
+int ClientMain(const CliOptions &opt) {
+    std::string request;
+    if (opt.export_files.size() > 0) {
+        if (opt.force) request += "force\n";
+        for (const auto &filename : opt.export_files) {
+            request += "export " + filename + "\n";
+        }
+    } else {
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+            request.append(buffer, n);
+        }
+    }
+    return spack::SendRequest(opt.client_socket, request);
+}
+
 int main(int argc, char *argv[]) {
+    spack::SetProfileThreadName("main");
+    CliOptions opt;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-export") == 0) {
+            while (i + 1 < argc && argv[i + 1][0] != '-') {
+                opt.export_files.push_back(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-export-list") == 0 && i + 1 < argc) {
+            if (!ReadExportList(argv[++i], &opt.export_files)) {
+                fprintf(stderr, "error: Failed to read %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-watch") == 0 && i + 1 < argc) {
+            opt.watch_file = argv[++i];
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            opt.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-max-memory") == 0 && i + 1 < argc) {
+            opt.max_memory = size_t(atoll(argv[++i])) << 20;
+        } else if (strcmp(argv[i], "-serve") == 0 && i + 1 < argc) {
+            opt.serve_socket = argv[++i];
+        } else if (strcmp(argv[i], "-client") == 0 && i + 1 < argc) {
+            opt.client_socket = argv[++i];
+        } else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+            opt.profile_file = argv[++i];
+            spack::StartProfile();
+        } else if (strcmp(argv[i], "-report") == 0 && i + 1 < argc) {
+            opt.report_file = argv[++i];
+        } else if (strcmp(argv[i], "-validate") == 0) {
+            opt.validate = true;
+        } else if (strcmp(argv[i], "-force") == 0) {
+            opt.force = true;
+        } else {
+            opt.project_file = argv[i];
+        }
+    }
+
+    if (opt.client_socket != nullptr) {
+        return ClientMain(opt);
+    }
+
+    bool headless = opt.export_files.size() > 0 || opt.watch_file != nullptr
+        || opt.serve_socket != nullptr;
+    int error;
+
+    if (headless) {
+        // Exporting never draws, atlases without a renderer skip creating
+        // textures so no display connection is needed.
+        spack::ProfileStartup();
+        if (opt.serve_socket != nullptr)
+            error = spack::Serve(nullptr, opt.serve_socket, opt.threads,
+                                 opt.max_memory);
+        else if (opt.watch_file != nullptr)
+            error = WatchMain(nullptr, opt);
+        else
+            error = CliMain(nullptr, opt);
+        SaveProfile(opt);
+        return error;
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "error: %s\n", SDL_GetError());
         return 1;
     }
-    bool headless = argc > 2 && strcmp(argv[1], "-export") == 0;
-    auto *window = spack::MakeDefaultWindow(headless);
+    auto *window = spack::MakeDefaultWindow();
     auto *device = spack::MakeDefaultRenderer(window);
-    int error;
-
-    if (headless)
-        error = CliMain(device, argv[2]);
-    else if (argc > 1)
-        error = UiMain(device, argv[1]);
-    else
-        error = UiMain(device);
+    spack::ProfileStartup();
+    error = UiMain(device, opt.project_file);
 
     SDL_DestroyRenderer(device);
     SDL_DestroyWindow(window);
+    SaveProfile(opt);
     return error;
 }
@@ -0,0 +1,148 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "thumbnails.h"
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "SDL.h"
+#include "image.h"
+
+namespace spack {
+
+static uint64_t HandleKey(SpriteHandle handle) {
+    return uint64_t(handle.slot) << 32 | handle.generation;
+}
+
+// Box filters the sprite into a size x size RGBA image, keeping its
+// aspect ratio and centering it. Colors are weighted by alpha so
+// transparent pixels do not darken the edges.
+static void Downsample(const Sprite &sprite, int size,
+                       std::vector<unsigned char> *out) {
+    out->assign(size_t(size) * size * 4, 0);
+    const auto &image = *sprite.image;
+    const auto &rect = sprite.rect;
+    if (rect.w <= 0 || rect.h <= 0) return;
+
+    float scale = std::min(1.0f, float(size) / float(std::max(rect.w, rect.h)));
+    int w = std::max(1, int(rect.w * scale));
+    int h = std::max(1, int(rect.h * scale));
+    int ox = (size - w) / 2;
+    int oy = (size - h) / 2;
+
+    for (int y = 0; y < h; ++y) {
+        int y0 = y * rect.h / h;
+        int y1 = std::max(y0 + 1, (y + 1) * rect.h / h);
+        for (int x = 0; x < w; ++x) {
+            int x0 = x * rect.w / w;
+            int x1 = std::max(x0 + 1, (x + 1) * rect.w / w);
+
+            // 64 bits since a cell of a large sprite can cover enough
+            // pixels to overflow 255 * 255 per pixel in 32 bits
+            uint64_t sum[4] = {0, 0, 0, 0};
+            for (int sy = y0; sy < y1; ++sy) {
+                const auto *row = &image.pixels[
+                    ((size_t(rect.y) + sy) * image.width + rect.x) * 4];
+                for (int sx = x0; sx < x1; ++sx) {
+                    const auto *px = &row[sx * 4];
+                    sum[0] += uint32_t(px[0] * px[3]);
+                    sum[1] += uint32_t(px[1] * px[3]);
+                    sum[2] += uint32_t(px[2] * px[3]);
+                    sum[3] += px[3];
+                }
+            }
+            auto *dst = &(*out)[(size_t(oy + y) * size + ox + x) * 4];
+            uint64_t n = uint64_t(x1 - x0) * uint64_t(y1 - y0);
+            if (sum[3] > 0) {
+                dst[0] = (unsigned char)(sum[0] / sum[3]);
+                dst[1] = (unsigned char)(sum[1] / sum[3]);
+                dst[2] = (unsigned char)(sum[2] / sum[3]);
+            }
+            dst[3] = (unsigned char)(sum[3] / n);
+        }
+    }
+}
+
+ThumbnailAtlas::~ThumbnailAtlas() {
+    if (texture != nullptr)
+        SDL_DestroyTexture(texture);
+}
+
+int ThumbnailAtlas::AllocateCell() {
+    if (cells.size() < size_t(Columns * Columns)) {
+        cells.push_back(Cell{});
+        return int(cells.size() - 1);
+    }
+    auto it = std::min_element(cells.begin(), cells.end(),
+        [](const Cell &a, const Cell &b) {
+            return a.last_used < b.last_used;
+        });
+    lookup.erase(HandleKey(it->owner));
+    return int(it - cells.begin());
+}
+
+SDL_Texture *ThumbnailAtlas::Get(SpriteHandle handle, const Sprite &sprite,
+                                 SDL_FRect *uv) {
+    if (device == nullptr || sprite.image == nullptr) {
+        return nullptr;
+    }
+    if (texture == nullptr) {
+        int size = CellSize * Columns;
+        texture = SDL_CreateTexture(device, SDL_PIXELFORMAT_RGBA32,
+                                    SDL_TEXTUREACCESS_STATIC, size, size);
+        if (texture == nullptr) return nullptr;
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    }
+
+    int cell;
+    auto it = lookup.find(HandleKey(handle));
+    if (it != lookup.end()) {
+        cell = it->second;
+    } else {
+        cell = AllocateCell();
+        cells[cell].owner = handle;
+        lookup[HandleKey(handle)] = cell;
+
+        std::vector<unsigned char> pixels;
+        Downsample(sprite, CellSize, &pixels);
+        SDL_Rect dst{(cell % Columns) * CellSize, (cell / Columns) * CellSize,
+                     CellSize, CellSize};
+        SDL_UpdateTexture(texture, &dst, pixels.data(), CellSize * 4);
+    }
+    cells[cell].last_used = ++clock;
+
+    float size = float(CellSize * Columns);
+    uv->x = float((cell % Columns) * CellSize) / size;
+    uv->y = float((cell / Columns) * CellSize) / size;
+    uv->w = float(CellSize) / size;
+    uv->h = float(CellSize) / size;
+    return texture;
+}
+
+void ThumbnailAtlas::Remove(SpriteHandle handle) {
+    auto it = lookup.find(HandleKey(handle));
+    if (it == lookup.end()) return;
+    // Least recently used so the cell is reused first
+    cells[it->second].last_used = 0;
+    cells[it->second].owner = SpriteHandle{};
+    lookup.erase(it);
+}
+
+} // namespace spack
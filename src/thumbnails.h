@@ -0,0 +1,72 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_THUMBNAILS_H
+#define SPACK_THUMBNAILS_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "SDL.h"
+#include "image.h"
+
+namespace spack {
+
+// Small copies of the sprites for the sprite lists, kept in cells of one
+// texture so a list draws all of its thumbnails from the same texture and
+// uses the same amount of video memory however many sprites there are.
+// Cells are reused starting with the thumbnail drawn least recently.
+class ThumbnailAtlas {
+public:
+    static constexpr int CellSize = 20;
+    static constexpr int Columns = 51;
+
+    explicit ThumbnailAtlas(SDL_Renderer *device) : device(device) {}
+    ~ThumbnailAtlas();
+
+    ThumbnailAtlas(const ThumbnailAtlas &) = delete;
+    ThumbnailAtlas &operator=(const ThumbnailAtlas &) = delete;
+
+    // Returns the texture and the cell containing the thumbnail in texture
+    // coordinates, downsampling the sprite into a cell if it is not in
+    // one. Returns nullptr if the sprite is not loaded.
+    SDL_Texture *Get(SpriteHandle handle, const Sprite &sprite,
+                     SDL_FRect *uv);
+
+    // Forgets the thumbnail of a sprite that changed or was removed.
+    void Remove(SpriteHandle handle);
+
+private:
+    struct Cell {
+        SpriteHandle owner;
+        uint64_t last_used = 0;
+    };
+    SDL_Renderer *device;
+    SDL_Texture *texture = nullptr;
+    std::vector<Cell> cells;
+    // Cell index of each sprite with a thumbnail
+    std::unordered_map<uint64_t, int> lookup;
+    uint64_t clock = 0;
+
+    int AllocateCell();
+};
+
+} // namespace spack
+
+#endif // SPACK_THUMBNAILS_H
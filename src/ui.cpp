@@ -22,6 +22,7 @@
 #include <memory>
 #include <chrono>
 #include <cmath>
+#include <algorithm>
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_sdl.h"
@@ -30,7 +31,9 @@
 #include "SDL.h"
 #include "atlas.h"
 #include "io.h"
+#include "jobs.h"
 #include "project.h"
+#include "report.h"
 
 namespace spack {
 
@@ -54,6 +57,11 @@ constexpr char Help_Export[] = "Export (Ctrl + E)";
 
 constexpr char Error_InvalidImage[] = "Invalid file format";
 constexpr char ErrorM_InvalidImage[] = "Could not open %s";
+constexpr char Error_InvalidProject[] = "Invalid project";
+constexpr char ErrorM_InvalidProject[] = "Could not load %s";
+
+// Frame time and idle overlay, toggled with F3
+static bool show_frame_stats = false;
 
 SDL_Renderer *MakeDefaultRenderer(SDL_Window *window) {
     uint32_t flags = SDL_RENDERER_ACCELERATED
@@ -65,16 +73,10 @@ SDL_Renderer *MakeDefaultRenderer(SDL_Window *window) {
     return SDL_CreateRenderer(window, 0, flags);
 }
 
-SDL_Window *MakeDefaultWindow(bool headless) {
+SDL_Window *MakeDefaultWindow() {
     auto flags = SDL_WINDOW_ALLOW_HIGHDPI
                | SDL_WINDOW_RESIZABLE;
 
-    // SDL_WINDOW_HIDDEN allows for true headless mode but some graphics
-    // operations seem to do nothing using SDL_Renderer, so we just run the
-    // window minimized for now but this won't work without a GPU.
-    if (headless)
-        flags |= SDL_WINDOW_MINIMIZED;
-
     return SDL_CreateWindow("Sprite Packer",
                             SDL_WINDOWPOS_CENTERED,
                             SDL_WINDOWPOS_CENTERED,
@@ -186,21 +188,8 @@ static void DrawAnimationsWindow(const Project &project) {
     // Cannot remove the default animation group
     if (ImGui::Button("Remove") && new_selected < atlas->animations.size()
             && new_selected > 0) {
-        for (int removed_frame : atlas->animations[new_selected].frames) {
-            auto &sprite = atlas->sprites[removed_frame];
-            SDL_DestroyTexture(sprite.texture);
-            atlas->sprites.erase(atlas->sprites.begin() + removed_frame);
-
-            for (auto &anim : atlas->animations) {
-                for (int &frame : anim.frames) {
-                    if (frame >= removed_frame)
-                        --frame;
-                }
-            }
-        }
-        atlas->animations.erase(atlas->animations.begin() + new_selected);
-        atlas->RenderSprites();
-        atlas->Render();
+        atlas->ExpandSources();
+        atlas->RemoveAnimation(new_selected);
         --new_selected;
     }
 
@@ -220,7 +209,7 @@ static void DrawAnimationsWindow(const Project &project) {
     ImGui::End();
 }
 
-static void DrawSpritesWindow(const Project &project) {
+static void DrawSpritesWindow(const Project &project, ThreadPool *workers) {
     auto &atlas = project.GetAtlas();
     auto &sprites = atlas->animations[atlas->selected_anim].frames;
 
@@ -228,6 +217,7 @@ static void DrawSpritesWindow(const Project &project) {
     ImGui::Begin("Sprites", nullptr, ImGuiWindowFlags_NoResize);
 
     if (ImGui::Button("Up") && atlas->selected_sprite > 0 && sprites.size() > 0) {
+        atlas->ExpandSources();
         std::swap(sprites[atlas->selected_sprite],
                   sprites[atlas->selected_sprite - 1]);
         --atlas->selected_sprite;
@@ -236,6 +226,7 @@ static void DrawSpritesWindow(const Project &project) {
 
     if (ImGui::Button("Down") && atlas->selected_sprite < sprites.size() - 1
             && sprites.size() > 0) {
+        atlas->ExpandSources();
         std::swap(sprites[atlas->selected_sprite],
                   sprites[atlas->selected_sprite + 1]);
         ++atlas->selected_sprite;
@@ -244,31 +235,30 @@ static void DrawSpritesWindow(const Project &project) {
 
     if (ImGui::Button("Remove") && atlas->selected_sprite < sprites.size()
             && sprites.size() > 0) {
-        int removed_frame = sprites[atlas->selected_sprite];
-        auto &sprite = atlas->sprites[removed_frame];
-
-        SDL_DestroyTexture(sprite.texture);
-
-        sprites.erase(sprites.begin() + atlas->selected_sprite);
-        atlas->sprites.erase(atlas->sprites.begin() + removed_frame);
-
-        for (auto &anim : atlas->animations) {
-            for (int &frame : anim.frames) {
-                if (frame >= removed_frame)
-                    --frame;
-            }
-        }
-        atlas->RenderSprites();
-        atlas->Render();
+        atlas->ExpandSources();
+        atlas->RemoveSprite(atlas->selected_anim, atlas->selected_sprite);
 
         if (atlas->selected_sprite > 0) --atlas->selected_sprite;
     }
 
+    if (atlas->imports.size() > 0) {
+        int done = atlas->import_batch - int(atlas->imports.size());
+        auto text = "Importing " + std::to_string(done) + "/"
+            + std::to_string(atlas->import_batch);
+        ImGui::ProgressBar(float(done) / float(atlas->import_batch),
+                           ImVec2(-1, 0), text.c_str());
+    }
+
     if (atlas->selected_anim > 0) {
         auto &anim = atlas->animations[atlas->selected_anim];
-        ImGui::InputText("Name", &anim.name);
+        bool edited = ImGui::InputText("Name", &anim.name);
         ImGui::SetNextItemWidth(100);
-        ImGui::InputFloat("Frame Time", &anim.frame_time, 0.0f, 0.0f, "%.3f");
+        edited = ImGui::InputFloat("Frame Time", &anim.frame_time,
+                                   0.0f, 0.0f, "%.3f") || edited;
+        if (edited && anim.source >= 0) {
+            // The anim_dir line would name and time it like the others
+            atlas->ExpandSources();
+        }
 
         if (anim.frame_time > 0.0f && anim.frame_time < 1.0f) {
             ImGui::SameLine();
@@ -277,32 +267,59 @@ static void DrawSpritesWindow(const Project &project) {
         DrawTooltip(Help_FrameTime);
     }
 
-    for (size_t i = 0; i < sprites.size(); ++i) {
-        int frame = sprites[i];
-        const auto &sprite = atlas->sprites[frame];
-        auto label = UniqueLabel(sprite.short_name, i);
+    // Only the visible rows are drawn
+    ImGuiListClipper clipper;
+    clipper.Begin(int(sprites.size()));
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+            size_t i = size_t(row);
+            size_t index = atlas->sprites.IndexOf(sprites[i]);
+            const auto &sprite = atlas->sprites[index];
+            auto label = UniqueLabel(sprite.short_name, i);
+
+            // Atlases opened from their cache decode sprites as they
+            // scroll into view
+            atlas->StreamSprite(workers, index);
+            SDL_FRect uv;
+            if (auto *thumb = atlas->SpriteThumbnail(index, &uv)) {
+                ImGui::Image(thumb, ImVec2(20, 20), ImVec2(uv.x, uv.y),
+                             ImVec2(uv.x + uv.w, uv.y + uv.h));
+            } else {
+                ImGui::Dummy(ImVec2(20, 20));
+            }
+            ImGui::SameLine();
 
-        ImGui::Image(sprite.texture, ImVec2(20, 20));
-        ImGui::SameLine();
+            ImGui::Text("%03d ", int(i));
+            ImGui::SameLine();
 
-        ImGui::Text("%03d ", int(i));
-        ImGui::SameLine();
+            if (ImGui::Selectable(label.c_str(), i == atlas->selected_sprite))
+                atlas->selected_sprite = i;
+        }
+    }
+    clipper.End();
 
-        if (ImGui::Selectable(label.c_str(), i == atlas->selected_sprite))
-            atlas->selected_sprite = i;
+    // Placeholders for sprites that are still being decoded
+    for (const auto &import : atlas->imports) {
+        if (size_t(import->anim) != atlas->selected_anim) continue;
+        ImGui::Dummy(ImVec2(20, 20));
+        ImGui::SameLine();
+        ImGui::TextDisabled("... %s", BaseSpriteName(import->filename).c_str());
     }
     ImGui::End();
 }
 
+// Stage is the first stage of rendering the option affects, options that
+// only change the exported files use Stage_None. The atlas is rendered
+// again in the background, see MainLoop.
 template <typename T>
 static void DrawOption(const std::unique_ptr<Atlas> &atlas, T *option,
+                       AtlasStage stage,
                        const std::function<void(T *opt)> &fn) {
     T opt = *option;
     fn(&opt);
     if (opt != *option) {
         *option = opt;
-        atlas->RenderSprites();
-        atlas->Render();
+        atlas->Invalidate(stage);
     }
 }
 
@@ -314,58 +331,77 @@ static void DrawAtlasWindow(const Project &project) {
     ImGui::Begin("Atlas", nullptr, ImGuiWindowFlags_NoResize);
     ImGui::Text("%dx%d", atlas->width, atlas->height);
 
-    DrawOption<bool>(atlas, &atlas->square_texture, [](bool *opt) {
-        ImGui::Checkbox("Square Texture", opt);
-    });
+    const auto &stats = atlas->stats;
+    ImGui::Text("%d sprites, %.1f%% occupied, %lld px wasted",
+                stats.sprites, Occupancy(stats) * 100.0,
+                (long long)WastedArea(stats));
+    ImGui::Text("VRAM %.1f KB, pack mask %.1f KB, %d retries",
+                EstimateVram(stats) / 1024.0,
+                stats.peak_mask_bytes / 1024.0, stats.pack_retries);
+
+    if (atlas->IsUpdating()) {
+        float progress = atlas->UpdateProgress();
+        ImGui::ProgressBar(progress, ImVec2(-1, 0),
+                           progress > 0.0f ? nullptr : "Packing...");
+    }
+
+    DrawOption<bool>(atlas, &atlas->square_texture, Stage_Pack,
+        [](bool *opt) {
+            ImGui::Checkbox("Square Texture", opt);
+        });
 
     Section("Padding");
-    DrawOption<int>(atlas, &atlas->padding, [](int *opt) {
+    DrawOption<int>(atlas, &atlas->padding, Stage_Pad, [](int *opt) {
         ImGui::SliderInt("Size", opt, 0, 8, "%dpx");
     });
 
-    DrawOption<PaddingMode>(atlas, &atlas->padding_mode, [](PaddingMode *m) {
-        const char *labels[3] = {"Bleed", "Alpha", "Debug"};
-        int selected = static_cast<int>(*m);
+    // Same padding size keeps the layout, only the pixels change
+    DrawOption<PaddingMode>(atlas, &atlas->padding_mode, Stage_Composite,
+        [](PaddingMode *m) {
+            const char *labels[3] = {"Bleed", "Alpha", "Debug"};
+            int selected = static_cast<int>(*m);
 
-        if (!ImGui::BeginCombo("Mode", labels[selected])) return;
-        for (int i = 0; i < 3; ++i) {
-            if (ImGui::Selectable(labels[i], i == selected))
-                *m = static_cast<PaddingMode>(i);
-        }
-        ImGui::EndCombo();
-    });
+            if (!ImGui::BeginCombo("Mode", labels[selected])) return;
+            for (int i = 0; i < 3; ++i) {
+                if (ImGui::Selectable(labels[i], i == selected))
+                    *m = static_cast<PaddingMode>(i);
+            }
+            ImGui::EndCombo();
+        });
 
     Section("Export");
-    DrawOption<bool>(atlas, &atlas->normalize, [](bool *opt) {
+    DrawOption<bool>(atlas, &atlas->normalize, Stage_None, [](bool *opt) {
         ImGui::Checkbox("Normalize Coordinates", opt);
         DrawTooltip(Help_Normalize);
     });
-    DrawOption<bool>(atlas, &atlas->y_up, [](bool *opt) {
+    DrawOption<bool>(atlas, &atlas->y_up, Stage_None, [](bool *opt) {
         ImGui::Checkbox("Y Up", opt);
         DrawTooltip(Help_YUp);
     });
 
     ImGui::Spacing();
     ImGui::Text("Atlas");
-    DrawOption<size_t>(atlas, &atlas->exporter, [&project](size_t *n) {
-        assert(*n < project.exporters.size());
-        auto &selected = project.exporters[*n].first;
-        if (!ImGui::BeginCombo("Format##Atlas", selected.c_str())) return;
-        for (size_t i = 0; i < project.exporters.size(); ++i) {
-            auto &name = project.exporters[i].first;
-            if (ImGui::Selectable(name.c_str(), i == *n)) {
-                auto &a = project.GetAtlas();
-                a->output_file = RenameWithExt(a->output_file, name);
-                *n = i;
+    DrawOption<size_t>(atlas, &atlas->exporter, Stage_None,
+        [&project](size_t *n) {
+            assert(*n < project.exporters.size());
+            auto &selected = project.exporters[*n].first;
+            if (!ImGui::BeginCombo("Format##Atlas", selected.c_str()))
+                return;
+            for (size_t i = 0; i < project.exporters.size(); ++i) {
+                auto &name = project.exporters[i].first;
+                if (ImGui::Selectable(name.c_str(), i == *n)) {
+                    auto &a = project.GetAtlas();
+                    a->output_file = RenameWithExt(a->output_file, name);
+                    *n = i;
+                }
             }
-        }
-        ImGui::EndCombo();
-    });
+            ImGui::EndCombo();
+        });
     ImGui::InputText("Path##Atlas", &atlas->output_file);
 
     ImGui::Spacing();
     ImGui::Text("Texture");
-    DrawOption<ImageFormat>(atlas, &atlas->image_format,
+    DrawOption<ImageFormat>(atlas, &atlas->image_format, Stage_None,
         [&atlas](ImageFormat *f) {
             int selected = static_cast<int>(*f);
             if (!ImGui::BeginCombo("Format##Texture", ImageExt[selected]))
@@ -388,6 +424,16 @@ static void DrawAtlasWindow(const Project &project) {
     ImGui::End();
 }
 
+// An empty project is opened if the project cannot be loaded. The file is
+// copied since loading replaces the project filename.
+static void OpenProject(SDL_Renderer *device, Project *project,
+                        std::string file) {
+    std::string error;
+    if (!project->Load(device, file, true, &error)) {
+        project->Error(Error_InvalidProject, file + ": " + error);
+    }
+}
+
 static void DrawProjectWindow(SDL_Renderer *device, Project *project) {
     static size_t selected = 0;
     ImGui::SetNextWindowBgAlpha(0.9f);
@@ -401,7 +447,7 @@ static void DrawProjectWindow(SDL_Renderer *device, Project *project) {
     ImGui::SameLine();
 
     if (ImGui::Button("Load")) {
-        project->Load(device, project->filename);
+        OpenProject(device, project, project->filename);
     }
     ImGui::SameLine();
 
@@ -444,43 +490,11 @@ static void DrawProjectWindow(SDL_Renderer *device, Project *project) {
     ImGui::End();
 }
 
-static void DrawBackground(SDL_Renderer *device, const SDL_Rect &rect) {
-    constexpr int CellSize = 16;
-    const uint8_t Colors[] = {0x80, 0xc0};
-
-    int dw, dh;
-    SDL_GetRendererOutputSize(device, &dw, &dh);
-    int width = rect.w / CellSize;
-    int height = rect.h / CellSize;
-
-    for (int y = 0; y <= height; ++y) {
-        for (int x = 0; x <= width; ++x) {
-            SDL_Rect dst{x * CellSize, y * CellSize,
-                         CellSize, CellSize};
-            if (x == width) {
-                dst.w = rect.w - dst.x;
-            }
-            if (y == height) {
-                dst.h = rect.h - dst.y;
-            }
-            dst.x += rect.x;
-            dst.y += rect.y;
-
-            if (dst.x + dst.w < 0 || dst.y + dst.h < 0
-                    || dst.x > dw || dst.h > dh) {
-                // Culling
-                continue;
-            }
-            auto color = Colors[((y & 1) + x) & 1];
-            SDL_SetRenderDrawColor(device, color, color, color, 255);
-            SDL_RenderFillRect(device, &dst);
-        }
-    }
-}
-
 static void DrawErrrorDialogs(Project *project) {
     DrawMessageDialog(Error_InvalidImage, ErrorM_InvalidImage,
                       project->error_msg.c_str());
+    DrawMessageDialog(Error_InvalidProject, ErrorM_InvalidProject,
+                      project->error_msg.c_str());
 
     if (project->error_id != nullptr) {
         ImGui::OpenPopup(project->error_id);
@@ -498,7 +512,8 @@ static void MouseDrag(const std::unique_ptr<Atlas> &atlas) {
     }
 }
 
-void RenderUi(SDL_Renderer *device, Project *project) {
+void RenderUi(SDL_Renderer *device, Project *project,
+              ThreadPool *import_workers) {
     auto &io = ImGui::GetIO();
 
     ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x - 320, 20));
@@ -515,7 +530,7 @@ void RenderUi(SDL_Renderer *device, Project *project) {
 
     ImGui::SetNextWindowPos(ImVec2(20, 340));
     ImGui::SetNextWindowSize(ImVec2(300, (io.DisplaySize.y - 300) - 60));
-    DrawSpritesWindow(*project);
+    DrawSpritesWindow(*project, import_workers);
 
     DrawErrrorDialogs(project);
 
@@ -536,16 +551,17 @@ void RenderUi(SDL_Renderer *device, Project *project) {
                  int(atlas->width * scale),
                  int(atlas->height * scale)};
 
-	DrawBackground(device, dst);
+    auto *preview = atlas->Preview();
+    assert(preview != nullptr);
+    preview->DrawBackdrop(dst);
     SDL_Rect border = {dst.x - 1, dst.y - 1, dst.w + 2, dst.h + 2};
     SDL_SetRenderDrawColor(device, 0, 0, 0, 255);
     SDL_RenderDrawRect(device, &border);
-
-    assert(atlas->texture != nullptr);
-    SDL_RenderCopy(device, atlas->texture, nullptr, &dst);
+    preview->Draw(atlas->image, dst);
 }
 
-void ProcessEvent(SDL_Renderer *device, Project *project, const SDL_Event &e) {
+void ProcessEvent(SDL_Renderer *device, Project *project,
+                  ThreadPool *import_workers, const SDL_Event &e) {
     auto &io = ImGui::GetIO();
     auto &atlas = project->GetAtlas();
     switch (e.type) {
@@ -557,14 +573,14 @@ void ProcessEvent(SDL_Renderer *device, Project *project, const SDL_Event &e) {
         break;
     case SDL_DROPFILE:
         if (HasExtension(e.drop.file, ".spritepack")) {
-            project->Load(device, e.drop.file);
+            OpenProject(device, project, e.drop.file);
             SDL_free(e.drop.file);
             break;
         }
-        if (atlas->AppendSprite(e.drop.file, atlas->selected_anim))
-            atlas->Render();
-        else
-            project->Error(Error_InvalidImage, e.drop.file);
+        // Files dropped together are decoded in parallel and packed once
+        // they are all added, see MainLoop
+        atlas->ImportSprite(import_workers, e.drop.file, atlas->selected_anim);
+        atlas->ExpandSources();
         SDL_free(e.drop.file);
         break;
     case SDL_KEYDOWN:
@@ -583,6 +599,9 @@ void ProcessEvent(SDL_Renderer *device, Project *project, const SDL_Event &e) {
             if (e.key.keysym.mod & KMOD_CTRL)
                 atlas->Export(project->exporters[atlas->exporter].second);
             break;
+        case SDLK_F3:
+            show_frame_stats = !show_frame_stats;
+            break;
         }
         break;
     case SDL_MOUSEBUTTONDOWN:
@@ -602,30 +621,103 @@ void ProcessEvent(SDL_Renderer *device, Project *project, const SDL_Event &e) {
     }
 }
 
+// Frames drawn after the last event so ImGui can finish reacting to it,
+// such as hover highlights and windows settling after a resize.
+constexpr int BurstFrames = 8;
+// Longest the idle editor waits for an event before checking again
+// whether it has anything to draw.
+constexpr int IdleTimeoutMs = 500;
+
+struct FrameStats {
+    // Time spent drawing the last frame
+    float frame_ms = 0.0f;
+    // Fraction of the last second spent waiting for events
+    float idle = 0.0f;
+};
+
+static void DrawFrameStats(const FrameStats &stats) {
+    if (!show_frame_stats) return;
+    ImGui::SetNextWindowPos(ImVec2(330, 20));
+    ImGui::SetNextWindowBgAlpha(0.6f);
+    ImGui::Begin("Frame Stats", nullptr,
+                 ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoInputs
+                 | ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Text("frame %.2f ms, idle %.0f%%", stats.frame_ms,
+                stats.idle * 100.0f);
+    ImGui::End();
+}
+
+static bool IsBusy(const Project &project) {
+    const auto &current = project.GetAtlas();
+    if (current->IsUpdating() || current->IsStreaming()) return true;
+    for (const auto &atlas : project.atlases) {
+        if (atlas->imports.size() > 0) return true;
+    }
+    return false;
+}
+
 void MainLoop(SDL_Renderer *device, Project *project) {
     assert(device != nullptr && project != nullptr);
-    auto frame_begin = std::chrono::high_resolution_clock::now();
+    using Clock = std::chrono::high_resolution_clock;
+    auto frame_begin = Clock::now();
     auto frame_end = frame_begin;
 
+    // Packs and composites edited atlases while the previous atlas is
+    // still shown
+    ThreadPool render_worker(1, "render");
+    // Decodes dropped sprites and the sprites of atlases opened from
+    // their cache
+    ThreadPool import_workers(0, "import");
+
+    FrameStats frame_stats;
+    auto stats_begin = frame_begin;
+    Clock::duration idle_time{0};
+    int burst = BurstFrames;
+
     auto &io = ImGui::GetIO();
     SDL_Event e;
+    auto handle_event = [&]() {
+        ImGui_ImplSDL2_ProcessEvent(&e);
+        ProcessEvent(device, project, &import_workers, e);
+        burst = BurstFrames;
+        return e.type != SDL_QUIT;
+    };
     for (;;) {
+        bool running = true;
+        if (burst == 0 && !IsBusy(*project)) {
+            // Nothing changes on screen until there is input, wait
+            // instead of drawing the same frame again
+            auto wait_begin = Clock::now();
+            bool woken = SDL_WaitEventTimeout(&e, IdleTimeoutMs);
+            idle_time += Clock::now() - wait_begin;
+            if (!woken) continue;
+            running = handle_event();
+        }
+        while (running && SDL_PollEvent(&e)) {
+            running = handle_event();
+        }
+        if (!running) {
+            for (auto &atlas : project->atlases)
+                atlas->CancelUpdate();
+            return;
+        }
+
         frame_begin = frame_end;
-        frame_end = std::chrono::high_resolution_clock::now();
+        frame_end = Clock::now();
         auto dt_micro = std::chrono::duration_cast<std::chrono::microseconds>(
             (frame_end - frame_begin)).count();
         float dt = float(double(dt_micro) * 1e-6);
 
-        while (SDL_PollEvent(&e)) {
-            ImGui_ImplSDL2_ProcessEvent(&e);
-            ProcessEvent(device, project, e);
-            if (e.type == SDL_QUIT) {
-                return;
-            }
+        for (auto &atlas : project->atlases) {
+            for (const auto &file : atlas->FinishImports())
+                project->Error(Error_InvalidImage, file);
         }
+        project->GetAtlas()->Open();
+        project->GetAtlas()->FinishSpriteLoads();
+        project->GetAtlas()->UpdateInBackground(&render_worker);
         int mx, my;
         int button = SDL_GetMouseState(&mx, &my);
-        io.DeltaTime = dt;
+        io.DeltaTime = std::max(dt, 1e-6f);
         io.MousePos = ImVec2(float(mx), float(my));
         io.MouseDown[0] = button & SDL_BUTTON(SDL_BUTTON_LEFT);
         io.MouseDown[1] = button & SDL_BUTTON(SDL_BUTTON_RIGHT);
@@ -639,10 +731,22 @@ void MainLoop(SDL_Renderer *device, Project *project) {
         SDL_RenderFillRect(device, nullptr);
 #endif
         ImGui::NewFrame();
-        RenderUi(device, project);
+        RenderUi(device, project, &import_workers);
+        DrawFrameStats(frame_stats);
         ImGui::Render();
         ImGuiSDL::Render(ImGui::GetDrawData());
         SDL_RenderPresent(device);
+        if (burst > 0) --burst;
+
+        auto now = Clock::now();
+        frame_stats.frame_ms = std::chrono::duration<float, std::milli>(
+            now - frame_end).count();
+        if (now - stats_begin >= std::chrono::seconds(1)) {
+            frame_stats.idle = std::chrono::duration<float>(idle_time).count()
+                / std::chrono::duration<float>(now - stats_begin).count();
+            stats_begin = now;
+            idle_time = Clock::duration{0};
+        }
     }
 }
 
@@ -21,6 +21,7 @@
 
 #include "SDL.h"
 #include "project.h"
+#include "jobs.h"
 #include "imgui/imgui.h"
 
 namespace spack {
@@ -29,11 +30,13 @@ constexpr int DefaultWindowW = 1280;
 constexpr int DefaultWindowH = 768;
 
 SDL_Renderer *MakeDefaultRenderer(SDL_Window *window);
-SDL_Window *MakeDefaultWindow(bool headless = false);
+SDL_Window *MakeDefaultWindow();
 void InitInput(ImGuiIO *io);
 
-void RenderUi(SDL_Renderer *deice, Project *project);
-void ProcessEvent(SDL_Renderer *device, Project *project, const SDL_Event &e);
+void RenderUi(SDL_Renderer *deice, Project *project,
+              ThreadPool *import_workers);
+void ProcessEvent(SDL_Renderer *device, Project *project,
+                  ThreadPool *import_workers, const SDL_Event &e);
 
 void MainLoop(SDL_Renderer *device, Project *project);
 
@@ -0,0 +1,147 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "watch.h"
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <unordered_set>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "io.h"
+#include "manifest.h"
+
+namespace spack {
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+    fd = inotify_init1(IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher() {
+    if (fd >= 0) close(fd);
+}
+
+void FileWatcher::Clear() {
+    for (const auto &dir : dirs) {
+        inotify_rm_watch(fd, dir.first);
+    }
+    dirs.clear();
+    files.clear();
+}
+
+void FileWatcher::Add(const std::string &filename) {
+    auto path = NormalizePath(filename);
+    if (!files.insert(path).second) return;
+
+    auto dir = std::filesystem::path(path).parent_path().u8string();
+    auto mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    int wd = inotify_add_watch(fd, dir.c_str(), mask);
+    if (wd >= 0) {
+        // Same directory returns the same watch descriptor
+        dirs[wd] = dir;
+    }
+}
+
+std::vector<std::string> FileWatcher::Wait(int debounce_ms) {
+    std::unordered_set<std::string> changed;
+    int timeout = -1;
+    alignas(inotify_event) char buffer[16 * 1024];
+
+    while (fd >= 0) {
+        pollfd pfd{fd, POLLIN, 0};
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        auto len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) break;
+
+        for (char *p = buffer; p < buffer + len; ) {
+            const auto *event = reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            auto dir = dirs.find(event->wd);
+            if (dir == dirs.end() || event->len == 0) continue;
+            auto path = dir->second + "/" + event->name;
+            if (files.count(path) > 0) {
+                changed.insert(path);
+            }
+        }
+        if (changed.size() > 0) {
+            timeout = debounce_ms;
+        }
+    }
+    return std::vector<std::string>(changed.begin(), changed.end());
+}
+
+#else
+
+FileWatcher::FileWatcher() {}
+FileWatcher::~FileWatcher() {}
+
+void FileWatcher::Clear() {
+    files.clear();
+    stats.clear();
+}
+
+void FileWatcher::Add(const std::string &filename) {
+    auto path = NormalizePath(filename);
+    if (!files.insert(path).second) return;
+
+    FileStat stat{0, 0};
+    StatFile(path, &stat.size, &stat.mtime);
+    stats[path] = stat;
+}
+
+std::vector<std::string> FileWatcher::Wait(int debounce_ms) {
+    constexpr int PollInterval = 100;
+    std::unordered_set<std::string> changed;
+    int quiet = 0;
+
+    while (changed.size() == 0 || quiet < debounce_ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PollInterval));
+        quiet += PollInterval;
+
+        for (auto &it : stats) {
+            FileStat stat{0, 0};
+            StatFile(it.first, &stat.size, &stat.mtime);
+            if (stat.size != it.second.size || stat.mtime != it.second.mtime) {
+                it.second = stat;
+                changed.insert(it.first);
+                quiet = 0;
+            }
+        }
+    }
+    return std::vector<std::string>(changed.begin(), changed.end());
+}
+
+#endif
+
+} // namespace spack
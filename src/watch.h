@@ -0,0 +1,66 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef SPACK_WATCH_H
+#define SPACK_WATCH_H
+
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <unordered_map>
+#include <cstdint>
+
+namespace spack {
+
+// Notifies about changes to a set of files. Uses inotify on Linux, other
+// platforms poll the file size and modification time.
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    void Clear();
+    void Add(const std::string &filename);
+
+    // Blocks until a watched file changes, then keeps collecting changes
+    // until no file changed for debounce_ms so a burst of saves results
+    // in a single rebuild. Files are identified by their NormalizePath.
+    std::vector<std::string> Wait(int debounce_ms);
+
+private:
+    std::unordered_set<std::string> files;
+#ifdef __linux__
+    int fd = -1;
+    // Directories are watched instead of files since editors often save
+    // by replacing the file.
+    std::unordered_map<int, std::string> dirs;
+#else
+    struct FileStat {
+        uint64_t size;
+        int64_t mtime;
+    };
+    std::unordered_map<std::string, FileStat> stats;
+#endif
+};
+
+} // namespace spack
+
+#endif // SPACK_WATCH_H